@@ -606,6 +606,11 @@ extern void LibVEX_Init (
    const VexControl* vcon
 );
 
+/* Update the global VexControl.  Can be called between translations,
+   for example to translate a particular block with different
+   chasing parameters. */
+extern void LibVEX_Update_Control (const VexControl * );
+
 
 /*-------------------------------------------------------*/
 /*--- Make a translation                              ---*/
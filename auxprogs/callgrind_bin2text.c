@@ -0,0 +1,465 @@
+/*--------------------------------------------------------------------*/
+/*--- Convert binary Callgrind profile dumps to the text format.  ---*/
+/*---                                         callgrind_bin2text.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Callgrind, a Valgrind tool for call tracing.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* Reads a dump written by "valgrind --tool=callgrind
+   --dump-format=binary" and writes the same dump in the text format
+   which --dump-format=text would have produced, byte for byte, so
+   that it can be read by callgrind_annotate or KCachegrind.
+
+   The layout of binary dumps is described in callgrind/binformat.h.
+   This is a standalone program: it does not use any Valgrind code. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "binformat.h"
+
+#define IN_BUFSIZE   (1 << 20)
+#define OUT_BUFSIZE  (1 << 20)
+
+static const char* in_name = "<stdin>";
+static int in_fd = 0;
+static unsigned char in_buf[IN_BUFSIZE];
+static size_t in_pos = 0, in_len = 0;
+
+static int out_fd = 1;
+static char out_buf[OUT_BUFSIZE];
+static size_t out_len = 0;
+
+static const char* tag_names[] = CLGB_TAG_NAMES;
+
+
+static void fail ( const char* msg )
+{
+   fprintf(stderr, "callgrind_bin2text: %s: %s\n", in_name, msg);
+   exit(1);
+}
+
+/*------------------------------------------------------------*/
+/*--- Buffered input and output                            ---*/
+/*------------------------------------------------------------*/
+
+static int fill_in ( void )
+{
+   ssize_t n;
+   do {
+      n = read(in_fd, in_buf, IN_BUFSIZE);
+   } while (n < 0 && errno == EINTR);
+   if (n < 0)
+      fail(strerror(errno));
+   in_pos = 0;
+   in_len = n;
+   return n > 0;
+}
+
+/* Returns the next byte, or -1 at the end of the input. */
+static inline int get_byte_or_eof ( void )
+{
+   if (in_pos == in_len && !fill_in())
+      return -1;
+   return in_buf[in_pos++];
+}
+
+static inline unsigned char get_byte ( void )
+{
+   int c = get_byte_or_eof();
+   if (c < 0)
+      fail("unexpected end of file");
+   return c;
+}
+
+static inline uint64_t get_uleb ( void )
+{
+   uint64_t v = 0;
+   int shift = 0;
+   unsigned char b;
+   do {
+      if (shift > 63)
+         fail("bad number");
+      b = get_byte();
+      v |= (uint64_t)(b & 0x7f) << shift;
+      shift += 7;
+   } while (b & 0x80);
+   return v;
+}
+
+static inline int64_t get_sleb ( void )
+{
+   uint64_t v = get_uleb();
+   return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static void flush_out ( void )
+{
+   size_t done = 0;
+   while (done < out_len) {
+      ssize_t n = write(out_fd, out_buf + done, out_len - done);
+      if (n < 0) {
+         if (errno == EINTR) continue;
+         fprintf(stderr, "callgrind_bin2text: write error: %s\n",
+                 strerror(errno));
+         exit(1);
+      }
+      done += n;
+   }
+   out_len = 0;
+}
+
+/* Make sure at least n bytes fit into the output buffer. */
+static inline void out_reserve ( size_t n )
+{
+   if (out_len + n > OUT_BUFSIZE)
+      flush_out();
+}
+
+static inline void put_char ( char c )
+{
+   out_reserve(1);
+   out_buf[out_len++] = c;
+}
+
+static void put_bytes ( const char* s, size_t len )
+{
+   while (len > 0) {
+      size_t n;
+      if (out_len == OUT_BUFSIZE)
+         flush_out();
+      n = OUT_BUFSIZE - out_len;
+      if (n > len) n = len;
+      memcpy(out_buf + out_len, s, n);
+      out_len += n;
+      s += n;
+      len -= n;
+   }
+}
+
+static inline void put_str ( const char* s )
+{
+   put_bytes(s, strlen(s));
+}
+
+static inline void put_dec ( uint64_t v )
+{
+   char tmp[20];
+   int i = 0;
+   out_reserve(20);
+   do {
+      tmp[i++] = '0' + v % 10;
+      v /= 10;
+   } while (v);
+   while (i > 0)
+      out_buf[out_len++] = tmp[--i];
+}
+
+/* As "%#lx" in callgrind's text dumps.  Valgrind's printf, unlike
+   the C library's, also prints the 0x prefix for 0, giving "0x0". */
+static inline void put_hex ( uint64_t v )
+{
+   char tmp[16];
+   int i = 0;
+   out_reserve(18);
+   out_buf[out_len++] = '0';
+   out_buf[out_len++] = 'x';
+   do {
+      tmp[i++] = "0123456789abcdef"[v & 15];
+      v >>= 4;
+   } while (v);
+   while (i > 0)
+      out_buf[out_len++] = tmp[--i];
+}
+
+/* Copy a length-prefixed name from input to output. */
+static void copy_name ( void )
+{
+   uint64_t len = get_uleb();
+   while (len > 0) {
+      size_t n;
+      if (in_pos == in_len && !fill_in())
+         fail("unexpected end of file");
+      n = in_len - in_pos;
+      if (n > len) n = len;
+      put_bytes((const char*)in_buf + in_pos, n);
+      in_pos += n;
+      len -= n;
+   }
+}
+
+/*------------------------------------------------------------*/
+/*--- Dump bodies                                          ---*/
+/*------------------------------------------------------------*/
+
+typedef struct {
+   uint64_t addr;
+   uint64_t bb;
+   uint32_t line;
+} Pos;
+
+static int      flags;
+static uint64_t addr_mask;
+
+static void read_pos ( Pos* curr, const Pos* last )
+{
+   if (flags & CLGB_FLAG_INSTR)
+      curr->addr = (last->addr + get_sleb()) & addr_mask;
+   if (flags & CLGB_FLAG_BB)
+      curr->bb = (last->bb + get_sleb()) & addr_mask;
+   if (flags & CLGB_FLAG_LINE)
+      curr->line = last->line + (uint32_t)get_sleb();
+}
+
+/* Same output as fprint_pos() in callgrind/dump.c */
+static inline void put_pos_field ( uint64_t curr, uint64_t last, int is_addr )
+{
+   int diff = (int)(curr - last);
+
+   if ((flags & CLGB_FLAG_COMPRESS) && last > 0 &&
+       diff > -100 && diff < 100) {
+      if (diff > 0) {
+         put_char('+');
+         put_dec(diff);
+      }
+      else if (diff == 0)
+         put_char('*');
+      else {
+         put_char('-');
+         put_dec(-diff);
+      }
+   }
+   else if (is_addr)
+      put_hex(curr);
+   else
+      put_dec(curr);
+   put_char(' ');
+}
+
+static void put_pos ( const Pos* curr, const Pos* last )
+{
+   if (flags & CLGB_FLAG_INSTR)
+      put_pos_field(curr->addr, last->addr, 1);
+   if (flags & CLGB_FLAG_BB)
+      put_pos_field(curr->bb, last->bb, 1);
+   if (flags & CLGB_FLAG_LINE)
+      put_pos_field(curr->line, last->line, 0);
+}
+
+static void copy_costs ( void )
+{
+   uint64_t i, n = get_uleb();
+
+   for (i = 0; i < n; i++) {
+      if (i > 0)
+         put_char(' ');
+      put_dec(get_uleb());
+   }
+   put_char('\n');
+}
+
+/* Convert one binary body, following a CLGB_BODY byte. */
+static void convert_body ( void )
+{
+   Pos last, curr, target;
+
+   flags = get_byte();
+   addr_mask = (flags & CLGB_FLAG_ADDR64) ? ~(uint64_t)0 : 0xffffffffULL;
+   memset(&last, 0, sizeof(last));
+
+   while (1) {
+      int op = get_byte();
+      uint64_t v;
+
+      switch (op) {
+      case CLGB_END:
+         return;
+
+      case CLGB_COST:
+         curr = last;
+         read_pos(&curr, &last);
+         put_pos(&curr, &last);
+         last = curr;
+         copy_costs();
+         break;
+
+      case CLGB_CALLS:
+         put_str("calls=");
+         put_dec(get_uleb());
+         put_char(' ');
+         target = curr = last;
+         read_pos(&target, &last);
+         read_pos(&curr, &last);
+         put_pos(&target, &last);
+         put_char('\n');
+         put_pos(&curr, &last);
+         copy_costs();
+         break;
+
+      case CLGB_JUMP:
+      case CLGB_JCND:
+         if (op == CLGB_JUMP) {
+            put_str("jump=");
+            put_dec(get_uleb());
+         }
+         else {
+            put_str("jcnd=");
+            put_dec(get_uleb());
+            put_char('/');
+            put_dec(get_uleb());
+         }
+         put_char(' ');
+         target = curr = last;
+         read_pos(&target, &last);
+         read_pos(&curr, &last);
+         put_pos(&target, &last);
+         put_char('\n');
+         put_pos(&curr, &last);
+         put_char('\n');
+         break;
+
+      case CLGB_NEWFN:
+         memset(&last, 0, sizeof(last));
+         break;
+
+      case CLGB_TEXT: {
+         int c;
+         while ((c = get_byte()) != 0)
+            put_char(c);
+         break;
+      }
+
+      default:
+         if (op < CLGB_TAG_FIRST || op > CLGB_TAG_LAST)
+            fail("corrupt binary dump");
+         put_str(tag_names[op - CLGB_TAG_FIRST]);
+         put_char('=');
+         v = get_uleb();
+         if (v == 0)
+            copy_name();
+         else {
+            v--;
+            put_char('(');
+            put_dec(v >> 1);
+            put_char(')');
+            if (v & 1) {
+               put_char(' ');
+               copy_name();
+            }
+         }
+         put_char('\n');
+         break;
+      }
+   }
+}
+
+static void convert ( void )
+{
+   const char* magic = CLGB_MAGIC;
+   size_t i;
+   int c;
+
+   /* With --separate-threads=yes, the file without thread suffix
+      stays empty */
+   if (!fill_in())
+      return;
+
+   for (i = 0; magic[i]; i++)
+      if (get_byte_or_eof() != (unsigned char)magic[i])
+         fail("not a binary callgrind profile dump");
+   put_str("# callgrind format\n");
+
+   /* Everything outside of bodies is text */
+   while ((c = get_byte_or_eof()) >= 0) {
+      if (c == CLGB_BODY)
+         convert_body();
+      else
+         put_char(c);
+   }
+   flush_out();
+}
+
+static void usage ( void )
+{
+   fprintf(stderr,
+      "usage: callgrind_bin2text [-o <output file>] [<binary dump>]\n"
+      "\n"
+      "  Converts a profile dump written by Callgrind with\n"
+      "  --dump-format=binary to the text format.  Reads from stdin\n"
+      "  and writes to stdout if no files are given.\n");
+   exit(1);
+}
+
+int main ( int argc, char** argv )
+{
+   int i;
+   const char* in_arg = NULL;
+   const char* out_name = NULL;
+
+   for (i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "-o") == 0 && i+1 < argc)
+         out_name = argv[++i];
+      else if (argv[i][0] == '-' && argv[i][1] != '\0')
+         usage();
+      else if (in_arg == NULL)
+         in_arg = argv[i];
+      else
+         usage();
+   }
+
+   if (in_arg && strcmp(in_arg, "-") != 0) {
+      in_name = in_arg;
+      in_fd = open(in_name, O_RDONLY);
+      if (in_fd < 0) {
+         fprintf(stderr, "callgrind_bin2text: can't open %s: %s\n",
+                 in_name, strerror(errno));
+         return 1;
+      }
+   }
+
+   if (out_name) {
+      out_fd = open(out_name, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+      if (out_fd < 0) {
+         fprintf(stderr, "callgrind_bin2text: can't create %s: %s\n",
+                 out_name, strerror(errno));
+         return 1;
+      }
+   }
+
+   convert();
+
+   if (out_name && close(out_fd) != 0) {
+      fprintf(stderr, "callgrind_bin2text: write error: %s\n",
+              strerror(errno));
+      return 1;
+   }
+   return 0;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                     callgrind_bin2text.c ---*/
+/*--------------------------------------------------------------------*/
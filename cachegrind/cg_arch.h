@@ -52,6 +52,10 @@ Bool VG_(str_clo_cache_opt)(const HChar *arg,
                             cache_t* clo_D1c,
                             cache_t* clo_LLc);
 
+// Likewise for the optional middle level cache, between L1 and LL, which
+// is never auto-detected.
+Bool VG_(str_clo_mid_cache_opt)(const HChar *arg, cache_t* clo_MLc);
+
 // Checks the correctness of the auto-detected caches.
 // If a cache has been configured by command line options, it
 // replaces the equivalent auto-detected cache.
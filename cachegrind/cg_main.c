@@ -61,6 +61,12 @@
 
 static Bool  clo_cache_sim  = True;  /* do cache simulation? */
 static Bool  clo_branch_sim = False; /* do branch simulation? */
+static Bool  clo_cache_sim_buffer = False; /* buffer accesses for the sim? */
+static Long  clo_sample_period = 0;        /* simulate 1 window per period */
+static Long  clo_sample_window = 100000;   /* instrs counted per window */
+static Long  clo_sample_warmup = 100000;   /* instrs simulated before one */
+static Bool  clo_per_thread_caches = False; /* private I1/D1/ML per thread? */
+static Bool  clo_tlb_sim    = False; /* do TLB simulation? */
 static const HChar* clo_cachegrind_out_file = "cachegrind.out.%p";
 
 /*------------------------------------------------------------*/
@@ -77,7 +83,10 @@ typedef
    struct {
       ULong a;  /* total # memory accesses of this kind */
       ULong m1; /* misses in the first level cache */
-      ULong mL; /* misses in the second level cache */
+      ULong mM; /* misses in the middle level cache, if any */
+      ULong mL; /* misses in the last level cache */
+      ULong mT; /* misses in the first level TLB, if simulated */
+      ULong mW; /* page walks, ie. misses in the second level TLB */
    }
    CacheCC;
 
@@ -267,13 +276,22 @@ static LineCC* get_lineCC(Addr origAddr)
       lineCC->loc.line = loc.line;
       lineCC->Ir.a     = 0;
       lineCC->Ir.m1    = 0;
+      lineCC->Ir.mM    = 0;
       lineCC->Ir.mL    = 0;
+      lineCC->Ir.mT    = 0;
+      lineCC->Ir.mW    = 0;
       lineCC->Dr.a     = 0;
       lineCC->Dr.m1    = 0;
+      lineCC->Dr.mM    = 0;
       lineCC->Dr.mL    = 0;
+      lineCC->Dr.mT    = 0;
+      lineCC->Dr.mW    = 0;
       lineCC->Dw.a     = 0;
       lineCC->Dw.m1    = 0;
+      lineCC->Dw.mM    = 0;
       lineCC->Dw.mL    = 0;
+      lineCC->Dw.mT    = 0;
+      lineCC->Dw.mW    = 0;
       lineCC->Bc.b     = 0;
       lineCC->Bc.mp    = 0;
       lineCC->Bi.b     = 0;
@@ -460,6 +478,302 @@ void log_ind_branch(InstrInfo* n, UWord actual_dst)
       += (1 & do_ind_branch_predict(n->instr_addr, actual_dst));
 }
 
+/*------------------------------------------------------------*/
+/*--- Buffered cache simulation                            ---*/
+/*------------------------------------------------------------*/
+
+/* With --cache-sim-buffer=yes, the instrumentation does not call a
+   helper for each group of cache events.  Instead it appends records
+   to evbuf with inline stores, and the simulator is only called, from
+   drain_event_buffer, when the buffer is full.  This replaces a helper
+   call (and the register saving around it) per one to three
+   instructions with one call per several thousand, and runs the
+   simulator in a tight loop over its tag arrays.
+
+   Only one thread runs at a time, so a single buffer keeps the
+   accesses in program order, and the simulated cache sees exactly the
+   same reference stream as with unbuffered simulation.  The buffer
+   must be drained before the counts are read and before any InstrInfo
+   it refers to is freed.
+
+   A record starts with a word holding the InstrInfo* for the access,
+   with the record kind in its two low bits (InstrInfos are at least
+   word aligned).  Instruction reads are one word long.  Data accesses
+   are followed by two more words, the data address and the size.  A
+   size of zero marks a guarded access whose guard was false.
+
+   The simulation of a middle level, of replacement policies other than
+   LRU and of prefetchers is always done from the buffer, by
+   drain_event_buffer_any, which keeps the other helpers (and the
+   common case) free of it. */
+
+#define EVBUF_IrNoX      0
+#define EVBUF_IrGen      1
+#define EVBUF_Dr         2
+#define EVBUF_Dw         3
+#define EVBUF_KIND_MASK  3
+
+#define EVBUF_WORDS  32768
+
+static UWord  evbuf[EVBUF_WORDS];
+static UWord* evbuf_next = evbuf;
+
+static void drain_event_buffer_any(void)
+{
+   UWord* p = evbuf;
+
+   while (p < evbuf_next) {
+      InstrInfo* n  = (InstrInfo*)(p[0] & ~(UWord)EVBUF_KIND_MASK);
+      LineCC*    cc = n->parent;
+
+      switch (p[0] & EVBUF_KIND_MASK) {
+         case EVBUF_IrNoX:
+         case EVBUF_IrGen:
+            cachesim_I1_doref_any(n->instr_addr, n->instr_len,
+                                  &cc->Ir.m1, &cc->Ir.mM, &cc->Ir.mL);
+            if (cachesim_has_TLB)
+               cachesim_TLB_doref(&ITLB, n->instr_addr, n->instr_len,
+                                  &cc->Ir.mT, &cc->Ir.mW);
+            cc->Ir.a++;
+            p += 1;
+            break;
+         case EVBUF_Dr:
+            if (p[2] != 0) {
+               cachesim_D1_doref_any(n->instr_addr, p[1], p[2],
+                                     &cc->Dr.m1, &cc->Dr.mM, &cc->Dr.mL);
+               if (cachesim_has_TLB)
+                  cachesim_TLB_doref(&DTLB, p[1], p[2],
+                                     &cc->Dr.mT, &cc->Dr.mW);
+               cc->Dr.a++;
+            }
+            p += 3;
+            break;
+         case EVBUF_Dw:
+            if (p[2] != 0) {
+               cachesim_D1_doref_any(n->instr_addr, p[1], p[2],
+                                     &cc->Dw.m1, &cc->Dw.mM, &cc->Dw.mL);
+               if (cachesim_has_TLB)
+                  cachesim_TLB_doref(&DTLB, p[1], p[2],
+                                     &cc->Dw.mT, &cc->Dw.mW);
+               cc->Dw.a++;
+            }
+            p += 3;
+            break;
+      }
+   }
+   tl_assert(p == evbuf_next);
+   evbuf_next = evbuf;
+}
+
+static void drain_event_buffer(void)
+{
+   UWord* p = evbuf;
+
+   if (cachesim_extended) {
+      drain_event_buffer_any();
+      return;
+   }
+
+   while (p < evbuf_next) {
+      InstrInfo* n = (InstrInfo*)(p[0] & ~(UWord)EVBUF_KIND_MASK);
+
+      switch (p[0] & EVBUF_KIND_MASK) {
+         case EVBUF_IrNoX:
+            cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
+                                  &n->parent->Ir.m1, &n->parent->Ir.mL);
+            n->parent->Ir.a++;
+            p += 1;
+            break;
+         case EVBUF_IrGen:
+            cachesim_I1_doref_Gen(n->instr_addr, n->instr_len,
+                                  &n->parent->Ir.m1, &n->parent->Ir.mL);
+            n->parent->Ir.a++;
+            p += 1;
+            break;
+         case EVBUF_Dr:
+            if (p[2] != 0) {
+               cachesim_D1_doref(p[1], p[2],
+                                 &n->parent->Dr.m1, &n->parent->Dr.mL);
+               n->parent->Dr.a++;
+            }
+            p += 3;
+            break;
+         case EVBUF_Dw:
+            if (p[2] != 0) {
+               cachesim_D1_doref(p[1], p[2],
+                                 &n->parent->Dw.m1, &n->parent->Dw.mL);
+               n->parent->Dw.a++;
+            }
+            p += 3;
+            break;
+      }
+   }
+   tl_assert(p == evbuf_next);
+   evbuf_next = evbuf;
+}
+
+/*------------------------------------------------------------*/
+/*--- Sampled cache simulation                             ---*/
+/*------------------------------------------------------------*/
+
+/* With --sample-period=P, the Ir, Dr and Dw counts are still exact,
+   and are kept by inline code, but the caches are only simulated for
+   the last U+W instructions of every P.  During the first U of those
+   (--sample-warmup) the caches are simulated to bring their contents
+   up to date, but misses are not counted; during the last W
+   (--sample-window) they are.  The simulation helpers are not called
+   at all in the rest of the period.
+
+   At exit, the misses are scaled up by the ratio of all instructions
+   to counted ones.  This is the ratio estimator of the total number of
+   misses, and its variance is estimated from the variation of the
+   misses per instruction between windows, to give the confidence
+   intervals written to the output file.
+
+   The instrumentation keeps sample_left, the number of instructions
+   left in the current phase, up to date, and calls sample_next_phase
+   when it has run out.  It only calls the simulation helpers while
+   sample_sim is non-zero.  Phases are switched between blocks of
+   code, so they can overrun by a few instructions; the instruction
+   counts of the windows take the overruns into account. */
+
+typedef
+   enum { SampleSkip, SampleWarmup, SampleCount }
+   SamplePhase;
+
+static SamplePhase sample_phase = SampleSkip;
+static Word        sample_left;
+static UWord       sample_sim;
+static Word        sample_count_start;  /* sample_left when counting began */
+
+/* Misses counted in the current window.  The events of each kind of
+   access are in the same order as the miss counts of a CacheCC. */
+enum { S_I1mr, S_IMmr, S_ILmr, S_ITLBm,  S_IWalk,
+       S_D1mr, S_DMmr, S_DLmr, S_DTLBmr, S_DWalkr,
+       S_D1mw, S_DMmw, S_DLmw, S_DTLBmw, S_DWalkw, S_N_EVENTS };
+static ULong sample_win[S_N_EVENTS];
+
+/* Sums over the finished windows; x is the number of instructions in a
+   window, y[e] the number of misses of event e. */
+static ULong  sample_n_windows;
+static ULong  sample_n_counted;
+static Double sample_sum_x, sample_sum_xx;
+static Double sample_sum_y[S_N_EVENTS], sample_sum_yy[S_N_EVENTS],
+              sample_sum_xy[S_N_EVENTS];
+
+static void sample_end_window(void)
+{
+   Word  x = sample_count_start - sample_left;
+   Int   e;
+
+   if (x > 0) {
+      sample_n_windows++;
+      sample_n_counted += x;
+      sample_sum_x     += (Double)x;
+      sample_sum_xx    += (Double)x * (Double)x;
+      for (e = 0; e < S_N_EVENTS; e++) {
+         Double y = (Double)sample_win[e];
+         sample_sum_y[e]  += y;
+         sample_sum_yy[e] += y * y;
+         sample_sum_xy[e] += (Double)x * y;
+      }
+   }
+   for (e = 0; e < S_N_EVENTS; e++)
+      sample_win[e] = 0;
+}
+
+static void sample_next_phase(void)
+{
+   while (sample_left <= 0) {
+      switch (sample_phase) {
+         case SampleSkip:
+            sample_phase = SampleWarmup;
+            sample_left += clo_sample_warmup;
+            break;
+         case SampleWarmup:
+            sample_phase = SampleCount;
+            sample_left += clo_sample_window;
+            sample_count_start = sample_left;
+            break;
+         case SampleCount:
+            sample_end_window();
+            sample_phase = SampleSkip;
+            sample_left += clo_sample_period - clo_sample_warmup
+                                             - clo_sample_window;
+            break;
+      }
+   }
+   sample_sim = sample_phase != SampleSkip;
+}
+
+/* Add the misses of one access, m, to its line's counts, cc, and, when
+   counting, to the window, where the events for this kind of access
+   start at first. */
+static void sample_add_misses(CacheCC* cc, const CacheCC* m, Int first)
+{
+   if (sample_phase != SampleCount)
+      return;
+   cc->m1 += m->m1;
+   cc->mM += m->mM;
+   cc->mL += m->mL;
+   cc->mT += m->mT;
+   cc->mW += m->mW;
+   sample_win[first + 0] += m->m1;
+   sample_win[first + 1] += m->mM;
+   sample_win[first + 2] += m->mL;
+   sample_win[first + 3] += m->mT;
+   sample_win[first + 4] += m->mW;
+}
+
+static VG_REGPARM(1)
+void log_sampled_Ir(InstrInfo* n)
+{
+   CacheCC m = { 0 };
+
+   if (cachesim_extended) {
+      cachesim_I1_doref_any(n->instr_addr, n->instr_len,
+                            &m.m1, &m.mM, &m.mL);
+      if (cachesim_has_TLB)
+         cachesim_TLB_doref(&ITLB, n->instr_addr, n->instr_len,
+                            &m.mT, &m.mW);
+   } else {
+      cachesim_I1_doref_Gen(n->instr_addr, n->instr_len, &m.m1, &m.mL);
+   }
+   sample_add_misses(&n->parent->Ir, &m, S_I1mr);
+}
+
+static VG_REGPARM(3)
+void log_sampled_Dr(InstrInfo* n, Addr data_addr, Word data_size)
+{
+   CacheCC m = { 0 };
+
+   if (cachesim_extended) {
+      cachesim_D1_doref_any(n->instr_addr, data_addr, data_size,
+                            &m.m1, &m.mM, &m.mL);
+      if (cachesim_has_TLB)
+         cachesim_TLB_doref(&DTLB, data_addr, data_size, &m.mT, &m.mW);
+   } else {
+      cachesim_D1_doref(data_addr, data_size, &m.m1, &m.mL);
+   }
+   sample_add_misses(&n->parent->Dr, &m, S_D1mr);
+}
+
+static VG_REGPARM(3)
+void log_sampled_Dw(InstrInfo* n, Addr data_addr, Word data_size)
+{
+   CacheCC m = { 0 };
+
+   if (cachesim_extended) {
+      cachesim_D1_doref_any(n->instr_addr, data_addr, data_size,
+                            &m.m1, &m.mM, &m.mL);
+      if (cachesim_has_TLB)
+         cachesim_TLB_doref(&DTLB, data_addr, data_size, &m.mT, &m.mW);
+   } else {
+      cachesim_D1_doref(data_addr, data_size, &m.m1, &m.mL);
+   }
+   sample_add_misses(&n->parent->Dw, &m, S_D1mw);
+}
+
 
 /*------------------------------------------------------------*/
 /*--- Instrumentation types and structures                 ---*/
@@ -502,6 +816,7 @@ typedef
    enum { 
       Ev_IrNoX,  // Instruction read not crossing cache lines
       Ev_IrGen,  // Generic Ir, not being detected as IrNoX
+      Ev_IrHit,  // Ir known to hit I1 (only with --cache-sim-buffer=yes)
       Ev_Dr,     // Data read
       Ev_Dw,     // Data write
       Ev_Dm,     // Data modify (read then write)
@@ -519,6 +834,8 @@ typedef
          } IrGen;
          struct {
          } IrNoX;
+         struct {
+         } IrHit;
          struct {
             IRAtom* ea;
             Int     szB;
@@ -585,6 +902,9 @@ typedef
       /* Number InstrInfo bins 'used' so far. */
       Int sbInfo_i;
 
+      /* The previous instruction of the SB, if any. */
+      InstrInfo* prev_inode;
+
       /* The output SB being constructed. */
       IRSB* sbOut;
    }
@@ -639,6 +959,9 @@ static void showEvent ( Event* ev )
       case Ev_IrNoX:
          VG_(printf)("IrNoX %p\n", ev->inode);
          break;
+      case Ev_IrHit:
+         VG_(printf)("IrHit %p\n", ev->inode);
+         break;
       case Ev_Dr:
          VG_(printf)("Dr %p %d EA=", ev->inode, ev->Ev.Dr.szB);
          ppIRExpr(ev->Ev.Dr.ea); 
@@ -686,6 +1009,333 @@ InstrInfo* setup_InstrInfo ( CgState* cgs, Addr instr_addr, UInt instr_len )
 }
 
 
+static IRAtom* assignNew ( CgState* cgs, IRType ty, IRExpr* e )
+{
+   IRTemp t = newIRTemp(cgs->sbOut->tyenv, ty);
+   addStmtToIRSB( cgs->sbOut, IRStmt_WrTmp(t, e) );
+   return IRExpr_RdTmp(t);
+}
+
+/* Generate code to add n, an Ity_I64 atom, to *ctr. */
+static void addToCounter ( CgState* cgs, ULong* ctr, IRAtom* n )
+{
+#  if defined(VG_BIGENDIAN)
+   IREndness end = Iend_BE;
+#  else
+   IREndness end = Iend_LE;
+#  endif
+   IRAtom*   addr = mkIRExpr_HWord((HWord)ctr);
+
+   addStmtToIRSB( cgs->sbOut,
+      IRStmt_Store(end, addr,
+                   assignNew(cgs, Ity_I64,
+                             IRExpr_Binop(Iop_Add64,
+                                          assignNew(cgs, Ity_I64,
+                                                    IRExpr_Load(end, Ity_I64,
+                                                                addr)),
+                                          n))) );
+}
+
+/* Generate code to add n to cc->Ir.a. */
+static void countHits ( CgState* cgs, LineCC* cc, Int n )
+{
+   if (n > 0)
+      addToCounter(cgs, &cc->Ir.a, IRExpr_Const(IRConst_U64(n)));
+}
+
+/* Generate code to append records for the cache events evs[0 .. n_evs-1]
+   to evbuf (see drain_event_buffer), draining it first if they might
+   not fit.  Branch events are not buffered but notified directly; the
+   branch predictors are independent of the caches, so this does not
+   change any result.  If guard is non-NULL, the data accesses are only
+   simulated if it is true. */
+static void bufferEvents ( CgState* cgs, Event* evs, Int n_evs,
+                           IRAtom* guard )
+{
+   IRType    tyW   = sizeof(HWord) == 4 ? Ity_I32 : Ity_I64;
+   IROp      opAdd = sizeof(HWord) == 4 ? Iop_Add32 : Iop_Add64;
+   IROp      opLT  = sizeof(HWord) == 4 ? Iop_CmpLT32U : Iop_CmpLT64U;
+#  if defined(VG_BIGENDIAN)
+   IREndness end   = Iend_BE;
+#  else
+   IREndness end   = Iend_LE;
+#  endif
+   Int       i, n_words, off;
+   IRAtom*   cur = NULL;
+   IRDirty*  di;
+   LineCC*   hit_cc = NULL;
+   Int       n_hits = 0;
+
+   n_words = 0;
+   for (i = 0; i < n_evs; i++) {
+      switch (evs[i].tag) {
+         case Ev_IrHit:                         break;
+         case Ev_IrNoX: case Ev_IrGen:          n_words += 1; break;
+         case Ev_Dr: case Ev_Dw: case Ev_Dm:    n_words += 3; break;
+         case Ev_Bc: case Ev_Bi:                break;
+         default:                               tl_assert(0);
+      }
+   }
+   tl_assert(n_words <= 3 * N_EVENTS);
+
+   if (n_words > 0) {
+      IRAtom* next = assignNew(cgs, tyW,
+                               IRExpr_Load(end, tyW,
+                                           mkIRExpr_HWord((HWord)&evbuf_next)));
+      IRAtom* full = assignNew(cgs, Ity_I1,
+                               IRExpr_Binop(opLT,
+                                  mkIRExpr_HWord(
+                                     (HWord)&evbuf[EVBUF_WORDS - n_words]),
+                                  next));
+      di = unsafeIRDirty_0_N( 0, "drain_event_buffer",
+                              VG_(fnptr_to_fnentry)( &drain_event_buffer ),
+                              mkIRExprVec_0() );
+      di->guard = full;
+      addStmtToIRSB( cgs->sbOut, IRStmt_Dirty(di) );
+      /* The drain may have reset evbuf_next, so load it again. */
+      cur = assignNew(cgs, tyW,
+                      IRExpr_Load(end, tyW,
+                                  mkIRExpr_HWord((HWord)&evbuf_next)));
+   }
+
+   off = 0;
+   for (i = 0; i < n_evs; i++) {
+      Event*  ev = &evs[i];
+      HWord   kind;
+      IRAtom* szB;
+
+      switch (ev->tag) {
+         case Ev_IrHit:
+            /* No simulation needed, just count it.  Consecutive hits
+               on the same line CC are counted together. */
+            if (hit_cc != ev->inode->parent) {
+               countHits(cgs, hit_cc, n_hits);
+               hit_cc = ev->inode->parent;
+               n_hits = 0;
+            }
+            n_hits++;
+            break;
+         case Ev_IrNoX:
+         case Ev_IrGen:
+            kind = ev->tag == Ev_IrNoX ? EVBUF_IrNoX : EVBUF_IrGen;
+            addStmtToIRSB( cgs->sbOut,
+               IRStmt_Store(end,
+                            assignNew(cgs, tyW,
+                                      IRExpr_Binop(opAdd, cur,
+                                                   mkIRExpr_HWord(off))),
+                            mkIRExpr_HWord((HWord)ev->inode | kind)) );
+            off += sizeof(UWord);
+            break;
+         case Ev_Dr:
+         case Ev_Dm:
+         case Ev_Dw:
+            kind = ev->tag == Ev_Dw ? EVBUF_Dw : EVBUF_Dr;
+            szB  = mkIRExpr_HWord(get_Event_dszB(ev));
+            if (guard)
+               szB = assignNew(cgs, tyW,
+                               IRExpr_ITE(guard, szB, mkIRExpr_HWord(0)));
+            addStmtToIRSB( cgs->sbOut,
+               IRStmt_Store(end,
+                            assignNew(cgs, tyW,
+                                      IRExpr_Binop(opAdd, cur,
+                                                   mkIRExpr_HWord(off))),
+                            mkIRExpr_HWord((HWord)ev->inode | kind)) );
+            addStmtToIRSB( cgs->sbOut,
+               IRStmt_Store(end,
+                            assignNew(cgs, tyW,
+                                      IRExpr_Binop(opAdd, cur,
+                                                   mkIRExpr_HWord(
+                                                      off + sizeof(UWord)))),
+                            get_Event_dea(ev)) );
+            addStmtToIRSB( cgs->sbOut,
+               IRStmt_Store(end,
+                            assignNew(cgs, tyW,
+                                      IRExpr_Binop(opAdd, cur,
+                                                   mkIRExpr_HWord(
+                                                      off + 2*sizeof(UWord)))),
+                            szB) );
+            off += 3 * sizeof(UWord);
+            break;
+         case Ev_Bc:
+            di = unsafeIRDirty_0_N( 2, "log_cond_branch",
+                                    VG_(fnptr_to_fnentry)( &log_cond_branch ),
+                                    mkIRExprVec_2(
+                                       mkIRExpr_HWord( (HWord)ev->inode ),
+                                       ev->Ev.Bc.taken ) );
+            addStmtToIRSB( cgs->sbOut, IRStmt_Dirty(di) );
+            break;
+         case Ev_Bi:
+            di = unsafeIRDirty_0_N( 2, "log_ind_branch",
+                                    VG_(fnptr_to_fnentry)( &log_ind_branch ),
+                                    mkIRExprVec_2(
+                                       mkIRExpr_HWord( (HWord)ev->inode ),
+                                       ev->Ev.Bi.dst ) );
+            addStmtToIRSB( cgs->sbOut, IRStmt_Dirty(di) );
+            break;
+         default:
+            tl_assert(0);
+      }
+   }
+   tl_assert(off == n_words * sizeof(UWord));
+   countHits(cgs, hit_cc, n_hits);
+
+   if (n_words > 0)
+      addStmtToIRSB( cgs->sbOut,
+         IRStmt_Store(end, mkIRExpr_HWord((HWord)&evbuf_next),
+                      assignNew(cgs, tyW,
+                                IRExpr_Binop(opAdd, cur,
+                                             mkIRExpr_HWord(off)))) );
+}
+
+/* Generate code for the events evs[0 .. n_evs-1] when sampling: update
+   the exact access counts inline, and call the simulation helpers if
+   the current phase needs them.  If guard is non-NULL, the data
+   accesses only happen if it is true. */
+static void sampleEvents ( CgState* cgs, Event* evs, Int n_evs,
+                           IRAtom* guard )
+{
+   IRType    tyW    = sizeof(HWord) == 4 ? Ity_I32 : Ity_I64;
+   IROp      opSub  = sizeof(HWord) == 4 ? Iop_Sub32 : Iop_Sub64;
+   IROp      opLE   = sizeof(HWord) == 4 ? Iop_CmpLE32S : Iop_CmpLE64S;
+   IROp      opNE   = sizeof(HWord) == 4 ? Iop_CmpNE32 : Iop_CmpNE64;
+#  if defined(VG_BIGENDIAN)
+   IREndness end    = Iend_BE;
+#  else
+   IREndness end    = Iend_LE;
+#  endif
+   /* The counters to update, and by how much.  Each event updates at
+      most one. */
+   ULong*    ctrs[N_EVENTS];
+   ULong     incs[N_EVENTS];
+   Int       i, j, n_ctrs = 0, n_Ir = 0;
+   Bool      any_cache_events = False;
+   IRAtom*   sim = NULL;
+   IRDirty*  di;
+
+   tl_assert(n_evs <= N_EVENTS);
+   for (i = 0; i < n_evs; i++) {
+      ULong* ctr;
+      switch (evs[i].tag) {
+         case Ev_IrNoX: case Ev_IrGen:
+            ctr = &evs[i].inode->parent->Ir.a;
+            n_Ir++;
+            break;
+         case Ev_Dr: case Ev_Dm:
+            ctr = &evs[i].inode->parent->Dr.a;
+            break;
+         case Ev_Dw:
+            ctr = &evs[i].inode->parent->Dw.a;
+            break;
+         case Ev_Bc: case Ev_Bi:
+            continue;
+         default:
+            tl_assert(0);
+      }
+      any_cache_events = True;
+      for (j = 0; j < n_ctrs && ctrs[j] != ctr; j++)
+         ;
+      if (j == n_ctrs) {
+         ctrs[n_ctrs] = ctr;
+         incs[n_ctrs] = 0;
+         n_ctrs++;
+      }
+      incs[j]++;
+   }
+
+   if (any_cache_events) {
+      IRAtom* left
+         = assignNew(cgs, tyW,
+                     IRExpr_Load(end, tyW,
+                                 mkIRExpr_HWord((HWord)&sample_left)));
+      di = unsafeIRDirty_0_N( 0, "sample_next_phase",
+                              VG_(fnptr_to_fnentry)( &sample_next_phase ),
+                              mkIRExprVec_0() );
+      di->guard = assignNew(cgs, Ity_I1,
+                            IRExpr_Binop(opLE, left, mkIRExpr_HWord(0)));
+      addStmtToIRSB( cgs->sbOut, IRStmt_Dirty(di) );
+      if (n_Ir > 0) {
+         left = assignNew(cgs, tyW,
+                          IRExpr_Load(end, tyW,
+                                      mkIRExpr_HWord((HWord)&sample_left)));
+         addStmtToIRSB( cgs->sbOut,
+            IRStmt_Store(end, mkIRExpr_HWord((HWord)&sample_left),
+                         assignNew(cgs, tyW,
+                                   IRExpr_Binop(opSub, left,
+                                                mkIRExpr_HWord(n_Ir)))) );
+      }
+      sim = assignNew(cgs, tyW,
+                      IRExpr_Load(end, tyW,
+                                  mkIRExpr_HWord((HWord)&sample_sim)));
+      if (guard)
+         sim = assignNew(cgs, tyW,
+                         IRExpr_ITE(guard, sim, mkIRExpr_HWord(0)));
+      sim = assignNew(cgs, Ity_I1,
+                      IRExpr_Binop(opNE, sim, mkIRExpr_HWord(0)));
+   }
+
+   for (j = 0; j < n_ctrs; j++) {
+      IRAtom* inc = IRExpr_Const(IRConst_U64(incs[j]));
+      if (guard)
+         inc = assignNew(cgs, Ity_I64,
+                         IRExpr_ITE(guard, inc, IRExpr_Const(IRConst_U64(0))));
+      addToCounter(cgs, ctrs[j], inc);
+   }
+
+   for (i = 0; i < n_evs; i++) {
+      Event*       ev         = &evs[i];
+      IRExpr*      i_node_expr = mkIRExpr_HWord( (HWord)ev->inode );
+      const HChar* helperName;
+      void*        helperAddr;
+      IRExpr**     argv;
+      Int          regparms;
+
+      switch (ev->tag) {
+         case Ev_IrNoX:
+         case Ev_IrGen:
+            helperName = "log_sampled_Ir";
+            helperAddr = &log_sampled_Ir;
+            argv       = mkIRExprVec_1( i_node_expr );
+            regparms   = 1;
+            break;
+         case Ev_Dr:
+         case Ev_Dm:
+            helperName = "log_sampled_Dr";
+            helperAddr = &log_sampled_Dr;
+            argv       = mkIRExprVec_3( i_node_expr, get_Event_dea(ev),
+                                        mkIRExpr_HWord(get_Event_dszB(ev)) );
+            regparms   = 3;
+            break;
+         case Ev_Dw:
+            helperName = "log_sampled_Dw";
+            helperAddr = &log_sampled_Dw;
+            argv       = mkIRExprVec_3( i_node_expr, get_Event_dea(ev),
+                                        mkIRExpr_HWord(get_Event_dszB(ev)) );
+            regparms   = 3;
+            break;
+         case Ev_Bc:
+            helperName = "log_cond_branch";
+            helperAddr = &log_cond_branch;
+            argv       = mkIRExprVec_2( i_node_expr, ev->Ev.Bc.taken );
+            regparms   = 2;
+            break;
+         case Ev_Bi:
+            helperName = "log_ind_branch";
+            helperAddr = &log_ind_branch;
+            argv       = mkIRExprVec_2( i_node_expr, ev->Ev.Bi.dst );
+            regparms   = 2;
+            break;
+         default:
+            tl_assert(0);
+      }
+      di = unsafeIRDirty_0_N( regparms,
+                              helperName, VG_(fnptr_to_fnentry)( helperAddr ),
+                              argv );
+      if (ev->tag != Ev_Bc && ev->tag != Ev_Bi)
+         di->guard = sim;
+      addStmtToIRSB( cgs->sbOut, IRStmt_Dirty(di) );
+   }
+}
+
 /* Generate code for all outstanding memory events, and mark the queue
    empty.  Code is generated into cgs->bbOut, and this activity
    'consumes' slots in cgs->sbInfo. */
@@ -702,6 +1352,17 @@ static void flushEvents ( CgState* cgs )
    Event*     ev2;
    Event*     ev3;
 
+   if (clo_sample_period > 0) {
+      sampleEvents(cgs, cgs->events, cgs->events_used, NULL);
+      cgs->events_used = 0;
+      return;
+   }
+   if (clo_cache_sim_buffer) {
+      bufferEvents(cgs, cgs->events, cgs->events_used, NULL);
+      cgs->events_used = 0;
+      return;
+   }
+
    i = 0;
    while (i < cgs->events_used) {
 
@@ -881,6 +1542,14 @@ static void addEvent_Ir ( CgState* cgs, InstrInfo* inode )
    evt = &cgs->events[cgs->events_used];
    init_Event(evt);
    evt->inode    = inode;
+   if (clo_cache_sim_buffer
+       && cgs->prev_inode
+       && cachesim_I1_is_MRU_hit(cgs->prev_inode->instr_addr,
+                                 cgs->prev_inode->instr_len,
+                                 inode->instr_addr, inode->instr_len)) {
+      evt->tag = Ev_IrHit;
+      distinct_instrsNoX++;
+   } else
    if (cachesim_is_IrNoX(inode->instr_addr, inode->instr_len)) {
       evt->tag = Ev_IrNoX;
       distinct_instrsNoX++;
@@ -889,6 +1558,7 @@ static void addEvent_Ir ( CgState* cgs, InstrInfo* inode )
       distinct_instrsGen++;
    }
    cgs->events_used++;
+   cgs->prev_inode = inode;
 }
 
 static
@@ -970,6 +1640,25 @@ void addEvent_D_guarded ( CgState* cgs, InstrInfo* inode,
    tl_assert(cgs->events_used >= 0);
    flushEvents(cgs);
    tl_assert(cgs->events_used == 0);
+   if (clo_sample_period > 0 || clo_cache_sim_buffer) {
+      Event ev;
+      init_Event(&ev);
+      ev.inode = inode;
+      if (isWrite) {
+         ev.tag       = Ev_Dw;
+         ev.Ev.Dw.ea  = ea;
+         ev.Ev.Dw.szB = datasize;
+      } else {
+         ev.tag       = Ev_Dr;
+         ev.Ev.Dr.ea  = ea;
+         ev.Ev.Dr.szB = datasize;
+      }
+      if (clo_sample_period > 0)
+         sampleEvents(cgs, &ev, 1, guard);
+      else
+         bufferEvents(cgs, &ev, 1, guard);
+      return;
+   }
    /* Same as case Ev_Dw / case Ev_Dr in flushEvents, except with guard */
    IRExpr*      i_node_expr;
    const HChar* helperName;
@@ -1085,6 +1774,7 @@ IRSB* cg_instrument ( VgCallbackClosure* closure,
    cgs.events_used = 0;
    cgs.sbInfo      = get_SB_info(sbIn, (Addr)closure->readdr);
    cgs.sbInfo_i    = 0;
+   cgs.prev_inode  = NULL;
 
    if (DEBUG_CG)
       VG_(printf)("\n\n---------- cg_instrument ----------\n");
@@ -1356,8 +2046,50 @@ IRSB* cg_instrument ( VgCallbackClosure* closure,
 
 static cache_t clo_I1_cache = UNDEFINED_CACHE;
 static cache_t clo_D1_cache = UNDEFINED_CACHE;
+static cache_t clo_ML_cache = UNDEFINED_CACHE;
 static cache_t clo_LL_cache = UNDEFINED_CACHE;
 
+// The defaults are those of recent x86 cores, for 4 KB pages.
+static tlb_t clo_ITLB = { 128,  8,  4096 };
+static tlb_t clo_DTLB = { 64,   4,  4096 };
+static tlb_t clo_STLB = { 1536, 12, 4096 };
+
+// Parse an option like --DTLB=64,4,4K.  The page size may have a K, M or
+// G suffix.
+static void parse_tlb_opt(tlb_t* tlb, const HChar* opt, const HChar* optval)
+{
+   Long   i1, i2, i3;
+   HChar* endptr;
+
+   i1 = VG_(strtoll10)(optval,   &endptr); if (*endptr != ',')  goto bad;
+   i2 = VG_(strtoll10)(endptr+1, &endptr); if (*endptr != ',')  goto bad;
+   i3 = VG_(strtoll10)(endptr+1, &endptr);
+   switch (*endptr) {
+      case 'K': i3 <<= 10; endptr++; break;
+      case 'M': i3 <<= 20; endptr++; break;
+      case 'G': i3 <<= 30; endptr++; break;
+      default:  break;
+   }
+   if (*endptr != '\0') goto bad;
+
+   if (i1 <= 0 || i1 > 1000000 || i2 <= 0 || i2 > i1 || i1 % i2 != 0
+       || -1 == VG_(log2)((UInt)(i1 / i2))) {
+      VG_(fmsg)("The number of TLB sets must be a power of two.\n");
+      goto bad;
+   }
+   if (i3 < 4096 || i3 > (1LL << 30) || -1 == VG_(log2)((UInt)i3)) {
+      VG_(fmsg)("The page size must be a power of two from 4K to 1G.\n");
+      goto bad;
+   }
+   tlb->entries   = (Int)i1;
+   tlb->assoc     = (Int)i2;
+   tlb->page_size = (Int)i3;
+   return;
+
+  bad:
+   VG_(fmsg_bad_option)(opt, "Bad argument '%s'\n", optval);
+}
+
 /*------------------------------------------------------------*/
 /*--- cg_fini() and related function                       ---*/
 /*------------------------------------------------------------*/
@@ -1370,6 +2102,115 @@ static CacheCC  Dw_total;
 static BranchCC Bc_total;
 static BranchCC Bi_total;
 
+/* When sampling: all instructions executed, and the relative half-width
+   of the 95% confidence interval for each estimated miss count, or -1
+   if it cannot be estimated. */
+static ULong  sample_n_instrs;
+static Double sample_ci[S_N_EVENTS];
+
+static Double sample_sqrt(Double x)
+{
+   Double r = x;
+   Int    i;
+
+   if (x <= 0.0)
+      return 0.0;
+   for (i = 0; i < 100; i++) {
+      Double r2 = (r + x / r) / 2;
+      if (r2 >= r)
+         break;
+      r = r2;
+   }
+   return r;
+}
+
+/* Finish the last window, estimate the misses and their confidence
+   intervals, and scale up the misses counted for each line. */
+static void sample_finish(void)
+{
+   Double  scale, k, R, s2, mean_x, f;
+   LineCC* lineCC;
+   Int     e;
+
+   if (sample_phase == SampleCount)
+      sample_end_window();
+
+   sample_n_instrs = 0;
+   VG_(OSetGen_ResetIter)(CC_table);
+   while ( (lineCC = VG_(OSetGen_Next)(CC_table)) )
+      sample_n_instrs += lineCC->Ir.a;
+
+   k = (Double)sample_n_windows;
+   for (e = 0; e < S_N_EVENTS; e++) {
+      sample_ci[e] = -1;
+      if (sample_n_windows < 2 || sample_sum_y[e] == 0)
+         continue;
+      R      = sample_sum_y[e] / sample_sum_x;
+      s2     = (sample_sum_yy[e] - 2 * R * sample_sum_xy[e]
+                + R * R * sample_sum_xx) / (k - 1);
+      mean_x = sample_sum_x / k;
+      f      = sample_sum_x / (Double)sample_n_instrs;
+      if (s2 < 0) s2 = 0;
+      if (f > 1)  f = 1;
+      /* Half-width of the interval for R * sample_n_instrs, relative
+         to it. */
+      sample_ci[e] = 1.96 * sample_sqrt((1 - f) * s2 / k) / mean_x / R;
+   }
+
+   scale = sample_n_counted > 0
+           ? (Double)sample_n_instrs / (Double)sample_n_counted : 0;
+   VG_(OSetGen_ResetIter)(CC_table);
+   while ( (lineCC = VG_(OSetGen_Next)(CC_table)) ) {
+      lineCC->Ir.m1 = (ULong)(lineCC->Ir.m1 * scale + 0.5);
+      lineCC->Ir.mM = (ULong)(lineCC->Ir.mM * scale + 0.5);
+      lineCC->Ir.mL = (ULong)(lineCC->Ir.mL * scale + 0.5);
+      lineCC->Ir.mT = (ULong)(lineCC->Ir.mT * scale + 0.5);
+      lineCC->Ir.mW = (ULong)(lineCC->Ir.mW * scale + 0.5);
+      lineCC->Dr.m1 = (ULong)(lineCC->Dr.m1 * scale + 0.5);
+      lineCC->Dr.mM = (ULong)(lineCC->Dr.mM * scale + 0.5);
+      lineCC->Dr.mL = (ULong)(lineCC->Dr.mL * scale + 0.5);
+      lineCC->Dr.mT = (ULong)(lineCC->Dr.mT * scale + 0.5);
+      lineCC->Dr.mW = (ULong)(lineCC->Dr.mW * scale + 0.5);
+      lineCC->Dw.m1 = (ULong)(lineCC->Dw.m1 * scale + 0.5);
+      lineCC->Dw.mM = (ULong)(lineCC->Dw.mM * scale + 0.5);
+      lineCC->Dw.mL = (ULong)(lineCC->Dw.mL * scale + 0.5);
+      lineCC->Dw.mT = (ULong)(lineCC->Dw.mT * scale + 0.5);
+      lineCC->Dw.mW = (ULong)(lineCC->Dw.mW * scale + 0.5);
+   }
+}
+
+static void fprint_CacheCC(VgFile* fp, const CacheCC* cc)
+{
+   if (cachesim_has_ML)
+      VG_(fprintf)(fp, " %llu %llu %llu %llu", cc->a, cc->m1, cc->mM, cc->mL);
+   else
+      VG_(fprintf)(fp, " %llu %llu %llu", cc->a, cc->m1, cc->mL);
+}
+
+/* Print the counts of lineCC for the events being simulated, and end
+   the line. */
+static void fprint_counts(VgFile* fp, const LineCC* lineCC)
+{
+   if (clo_cache_sim) {
+      fprint_CacheCC(fp, &lineCC->Ir);
+      fprint_CacheCC(fp, &lineCC->Dr);
+      fprint_CacheCC(fp, &lineCC->Dw);
+      if (cachesim_has_TLB)
+         VG_(fprintf)(fp, " %llu %llu %llu %llu %llu %llu",
+                          lineCC->Ir.mT, lineCC->Ir.mW,
+                          lineCC->Dr.mT, lineCC->Dr.mW,
+                          lineCC->Dw.mT, lineCC->Dw.mW);
+   } else {
+      VG_(fprintf)(fp, " %llu", lineCC->Ir.a);
+   }
+   if (clo_branch_sim) {
+      VG_(fprintf)(fp, " %llu %llu %llu %llu",
+                       lineCC->Bc.b, lineCC->Bc.mp,
+                       lineCC->Bi.b, lineCC->Bi.mp);
+   }
+   VG_(fprintf)(fp, "\n");
+}
+
 static void fprint_CC_table_and_calc_totals(void)
 {
    Int     i;
@@ -1403,9 +2244,56 @@ static void fprint_CC_table_and_calc_totals(void)
    // "desc:" lines (giving I1/D1/LL cache configuration).  The spaces after
    // the 2nd colon makes cg_annotate's output look nicer.
    VG_(fprintf)(fp,  "desc: I1 cache:         %s\n"
-                     "desc: D1 cache:         %s\n"
-                     "desc: LL cache:         %s\n",
-                     I1.desc_line, D1.desc_line, LL.desc_line);
+                     "desc: D1 cache:         %s\n",
+                     I1.desc_line, D1.desc_line);
+   if (cachesim_has_ML)
+      VG_(fprintf)(fp, "desc: ML cache:         %s\n", ML.desc_line);
+   VG_(fprintf)(fp,  "desc: LL cache:         %s\n", LL.desc_line);
+   if (cachesim_has_TLB) {
+      VG_(fprintf)(fp, "desc: ITLB:             %s\n"
+                       "desc: DTLB:             %s\n"
+                       "desc: STLB:             %s\n",
+                       ITLB.desc_line, DTLB.desc_line, STLB.desc_line);
+   }
+   if (cachesim_repl != Repl_LRU || cachesim_prefetch != Pf_None) {
+      VG_(fprintf)(fp, "desc: Replacement:      %s\n",
+                       cachesim_repl == Repl_PLRU  ? "plru"
+                     : cachesim_repl == Repl_SRRIP ? "srrip" : "lru");
+      VG_(fprintf)(fp, "desc: D1 prefetch:      %s\n",
+                       cachesim_prefetch == Pf_NextLine ? "next-line"
+                     : cachesim_prefetch == Pf_Stride   ? "stride" : "none");
+   }
+
+   // More "desc:" lines when the misses are estimates from sampling.
+   if (clo_sample_period > 0) {
+      static const HChar* const names[S_N_EVENTS]
+         = { "I1mr", "IMmr", "ILmr", "ITLBm",  "IWalk",
+             "D1mr", "DMmr", "DLmr", "DTLBmr", "DWalkr",
+             "D1mw", "DMmw", "DLmw", "DTLBmw", "DWalkw" };
+      Int e;
+
+      VG_(fprintf)(fp, "desc: Sampling:         last %lld of every %lld "
+                       "instrs, after %lld of warm-up\n",
+                       clo_sample_window, clo_sample_period,
+                       clo_sample_warmup);
+      VG_(fprintf)(fp, "desc: Sampled:          %llu windows, %llu of %llu "
+                       "instrs (%.1f%%)\n",
+                       sample_n_windows, sample_n_counted, sample_n_instrs,
+                       sample_n_instrs > 0
+                       ? sample_n_counted * 100.0 / sample_n_instrs : 0.0);
+      VG_(fprintf)(fp, "desc: Misses, 95%% CI:  ");
+      for (e = 0; e < S_N_EVENTS; e++) {
+         if (!cachesim_has_ML && e % 5 == S_IMmr)
+            continue;
+         if (!cachesim_has_TLB && e % 5 >= S_ITLBm)
+            continue;
+         if (sample_ci[e] < 0)
+            VG_(fprintf)(fp, " %s n/a", names[e]);
+         else
+            VG_(fprintf)(fp, " %s +-%.1f%%", names[e], sample_ci[e] * 100);
+      }
+      VG_(fprintf)(fp, "\n");
+   }
 
    // "cmd:" line
    VG_(fprintf)(fp, "cmd: %s", VG_(args_the_exename));
@@ -1414,20 +2302,19 @@ static void fprint_CC_table_and_calc_totals(void)
       VG_(fprintf)(fp, " %s", arg);
    }
    // "events:" line
-   if (clo_cache_sim && clo_branch_sim) {
-      VG_(fprintf)(fp, "\nevents: Ir I1mr ILmr Dr D1mr DLmr Dw D1mw DLmw "
-                                  "Bc Bcm Bi Bim\n");
-   }
-   else if (clo_cache_sim && !clo_branch_sim) {
-      VG_(fprintf)(fp, "\nevents: Ir I1mr ILmr Dr D1mr DLmr Dw D1mw DLmw "
-                                  "\n");
-   }
-   else if (!clo_cache_sim && clo_branch_sim) {
-      VG_(fprintf)(fp, "\nevents: Ir Bc Bcm Bi Bim\n");
-   }
-   else {
-      VG_(fprintf)(fp, "\nevents: Ir\n");
+   VG_(fprintf)(fp, "\nevents: Ir");
+   if (clo_cache_sim) {
+      if (cachesim_has_ML)
+         VG_(fprintf)(fp, " I1mr IMmr ILmr Dr D1mr DMmr DLmr"
+                          " Dw D1mw DMmw DLmw");
+      else
+         VG_(fprintf)(fp, " I1mr ILmr Dr D1mr DLmr Dw D1mw DLmw");
    }
+   if (clo_cache_sim && cachesim_has_TLB)
+      VG_(fprintf)(fp, " ITLBm IWalk DTLBmr DWalkr DTLBmw DWalkw");
+   if (clo_branch_sim)
+      VG_(fprintf)(fp, " Bc Bcm Bi Bim");
+   VG_(fprintf)(fp, "\n");
 
    // Traverse every lineCC
    VG_(OSetGen_ResetIter)(CC_table);
@@ -1455,51 +2342,28 @@ static void fprint_CC_table_and_calc_totals(void)
       }
 
       // Print the LineCC
-      if (clo_cache_sim && clo_branch_sim) {
-         VG_(fprintf)(fp,  "%d %llu %llu %llu"
-                             " %llu %llu %llu"
-                             " %llu %llu %llu"
-                             " %llu %llu %llu %llu\n",
-                            lineCC->loc.line,
-                            lineCC->Ir.a, lineCC->Ir.m1, lineCC->Ir.mL, 
-                            lineCC->Dr.a, lineCC->Dr.m1, lineCC->Dr.mL,
-                            lineCC->Dw.a, lineCC->Dw.m1, lineCC->Dw.mL,
-                            lineCC->Bc.b, lineCC->Bc.mp, 
-                            lineCC->Bi.b, lineCC->Bi.mp);
-      }
-      else if (clo_cache_sim && !clo_branch_sim) {
-         VG_(fprintf)(fp,  "%d %llu %llu %llu"
-                             " %llu %llu %llu"
-                             " %llu %llu %llu\n",
-                            lineCC->loc.line,
-                            lineCC->Ir.a, lineCC->Ir.m1, lineCC->Ir.mL, 
-                            lineCC->Dr.a, lineCC->Dr.m1, lineCC->Dr.mL,
-                            lineCC->Dw.a, lineCC->Dw.m1, lineCC->Dw.mL);
-      }
-      else if (!clo_cache_sim && clo_branch_sim) {
-         VG_(fprintf)(fp,  "%d %llu"
-                             " %llu %llu %llu %llu\n",
-                            lineCC->loc.line,
-                            lineCC->Ir.a, 
-                            lineCC->Bc.b, lineCC->Bc.mp, 
-                            lineCC->Bi.b, lineCC->Bi.mp);
-      }
-      else {
-         VG_(fprintf)(fp,  "%d %llu\n",
-                            lineCC->loc.line,
-                            lineCC->Ir.a);
-      }
+      VG_(fprintf)(fp, "%d", lineCC->loc.line);
+      fprint_counts(fp, lineCC);
 
       // Update summary stats
       Ir_total.a  += lineCC->Ir.a;
       Ir_total.m1 += lineCC->Ir.m1;
+      Ir_total.mM += lineCC->Ir.mM;
       Ir_total.mL += lineCC->Ir.mL;
+      Ir_total.mT += lineCC->Ir.mT;
+      Ir_total.mW += lineCC->Ir.mW;
       Dr_total.a  += lineCC->Dr.a;
       Dr_total.m1 += lineCC->Dr.m1;
+      Dr_total.mM += lineCC->Dr.mM;
       Dr_total.mL += lineCC->Dr.mL;
+      Dr_total.mT += lineCC->Dr.mT;
+      Dr_total.mW += lineCC->Dr.mW;
       Dw_total.a  += lineCC->Dw.a;
       Dw_total.m1 += lineCC->Dw.m1;
+      Dw_total.mM += lineCC->Dw.mM;
       Dw_total.mL += lineCC->Dw.mL;
+      Dw_total.mT += lineCC->Dw.mT;
+      Dw_total.mW += lineCC->Dw.mW;
       Bc_total.b  += lineCC->Bc.b;
       Bc_total.mp += lineCC->Bc.mp;
       Bi_total.b  += lineCC->Bi.b;
@@ -1510,39 +2374,15 @@ static void fprint_CC_table_and_calc_totals(void)
 
    // Summary stats must come after rest of table, since we calculate them
    // during traversal.  */
-   if (clo_cache_sim && clo_branch_sim) {
-      VG_(fprintf)(fp,  "summary:"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu %llu\n", 
-                        Ir_total.a, Ir_total.m1, Ir_total.mL,
-                        Dr_total.a, Dr_total.m1, Dr_total.mL,
-                        Dw_total.a, Dw_total.m1, Dw_total.mL,
-                        Bc_total.b, Bc_total.mp, 
-                        Bi_total.b, Bi_total.mp);
-   }
-   else if (clo_cache_sim && !clo_branch_sim) {
-      VG_(fprintf)(fp,  "summary:"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu\n",
-                        Ir_total.a, Ir_total.m1, Ir_total.mL,
-                        Dr_total.a, Dr_total.m1, Dr_total.mL,
-                        Dw_total.a, Dw_total.m1, Dw_total.mL);
-   }
-   else if (!clo_cache_sim && clo_branch_sim) {
-      VG_(fprintf)(fp,  "summary:"
-                        " %llu"
-                        " %llu %llu %llu %llu\n", 
-                        Ir_total.a,
-                        Bc_total.b, Bc_total.mp, 
-                        Bi_total.b, Bi_total.mp);
-   }
-   else {
-      VG_(fprintf)(fp, "summary:"
-                        " %llu\n", 
-                        Ir_total.a);
+   {
+      LineCC total;
+      total.Ir = Ir_total;
+      total.Dr = Dr_total;
+      total.Dw = Dw_total;
+      total.Bc = Bc_total;
+      total.Bi = Bi_total;
+      VG_(fprintf)(fp, "summary:");
+      fprint_counts(fp, &total);
    }
 
    VG_(fclose)(fp);
@@ -1569,6 +2409,11 @@ static void cg_fini(Int exitcode)
          LL_total, LL_total_r, LL_total_w;
    Int l1, l2, l3;
 
+   if (clo_cache_sim_buffer)
+      drain_event_buffer();
+   if (clo_sample_period > 0)
+      sample_finish();
+
    fprint_CC_table_and_calc_totals();
 
    if (VG_(clo_verbosity) == 0) 
@@ -1593,11 +2438,16 @@ static void cg_fini(Int exitcode)
       miss numbers */
    if (clo_cache_sim) {
       VG_(umsg)(fmt, "I1  misses:   ", Ir_total.m1);
+      if (cachesim_has_ML)
+         VG_(umsg)(fmt, "MLi misses:   ", Ir_total.mM);
       VG_(umsg)(fmt, "LLi misses:   ", Ir_total.mL);
 
       if (0 == Ir_total.a) Ir_total.a = 1;
       VG_(umsg)("I1  miss rate: %*.2f%%\n", l1,
                 Ir_total.m1 * 100.0 / Ir_total.a);
+      if (cachesim_has_ML)
+         VG_(umsg)("MLi miss rate: %*.2f%%\n", l1,
+                   Ir_total.mM * 100.0 / Ir_total.a);
       VG_(umsg)("LLi miss rate: %*.2f%%\n", l1,
                 Ir_total.mL * 100.0 / Ir_total.a);
       VG_(umsg)("\n");
@@ -1606,6 +2456,7 @@ static void cg_fini(Int exitcode)
        * determine the width of columns 2 & 3. */
       D_total.a  = Dr_total.a  + Dw_total.a;
       D_total.m1 = Dr_total.m1 + Dw_total.m1;
+      D_total.mM = Dr_total.mM + Dw_total.mM;
       D_total.mL = Dr_total.mL + Dw_total.mL;
 
       /* Make format string, getting width right for numbers */
@@ -1616,6 +2467,9 @@ static void cg_fini(Int exitcode)
                      D_total.a, Dr_total.a, Dw_total.a);
       VG_(umsg)(fmt, "D1  misses:   ",
                      D_total.m1, Dr_total.m1, Dw_total.m1);
+      if (cachesim_has_ML)
+         VG_(umsg)(fmt, "MLd misses:   ",
+                        D_total.mM, Dr_total.mM, Dw_total.mM);
       VG_(umsg)(fmt, "LLd misses:   ",
                      D_total.mL, Dr_total.mL, Dw_total.mL);
 
@@ -1626,17 +2480,49 @@ static void cg_fini(Int exitcode)
                 l1, D_total.m1  * 100.0 / D_total.a,
                 l2, Dr_total.m1 * 100.0 / Dr_total.a,
                 l3, Dw_total.m1 * 100.0 / Dw_total.a);
+      if (cachesim_has_ML)
+         VG_(umsg)("MLd miss rate: %*.1f%% (%*.1f%%     + %*.1f%%  )\n",
+                   l1, D_total.mM  * 100.0 / D_total.a,
+                   l2, Dr_total.mM * 100.0 / Dr_total.a,
+                   l3, Dw_total.mM * 100.0 / Dw_total.a);
       VG_(umsg)("LLd miss rate: %*.1f%% (%*.1f%%     + %*.1f%%  )\n",
                 l1, D_total.mL  * 100.0 / D_total.a,
                 l2, Dr_total.mL * 100.0 / Dr_total.a,
                 l3, Dw_total.mL * 100.0 / Dw_total.a);
       VG_(umsg)("\n");
 
+      /* ML overall results */
+
+      if (cachesim_has_ML) {
+         ULong ML_total   = Dr_total.m1 + Dw_total.m1 + Ir_total.m1;
+         ULong ML_total_r = Dr_total.m1 + Ir_total.m1;
+         ULong ML_total_w = Dw_total.m1;
+         ULong ML_total_m  = Dr_total.mM + Dw_total.mM + Ir_total.mM;
+         ULong ML_total_mr = Dr_total.mM + Ir_total.mM;
+         ULong ML_total_mw = Dw_total.mM;
+
+         VG_(umsg)(fmt, "ML refs:      ",
+                        ML_total, ML_total_r, ML_total_w);
+         VG_(umsg)(fmt, "ML misses:    ",
+                        ML_total_m, ML_total_mr, ML_total_mw);
+         VG_(umsg)("ML miss rate:  %*.1f%% (%*.1f%%     + %*.1f%%  )\n",
+                   l1, ML_total_m  * 100.0 / (Ir_total.a + D_total.a),
+                   l2, ML_total_mr * 100.0 / (Ir_total.a + Dr_total.a),
+                   l3, ML_total_mw * 100.0 / Dw_total.a);
+         VG_(umsg)("\n");
+      }
+
       /* LL overall results */
 
-      LL_total   = Dr_total.m1 + Dw_total.m1 + Ir_total.m1;
-      LL_total_r = Dr_total.m1 + Ir_total.m1;
-      LL_total_w = Dw_total.m1;
+      if (cachesim_has_ML) {
+         LL_total   = Dr_total.mM + Dw_total.mM + Ir_total.mM;
+         LL_total_r = Dr_total.mM + Ir_total.mM;
+         LL_total_w = Dw_total.mM;
+      } else {
+         LL_total   = Dr_total.m1 + Dw_total.m1 + Ir_total.m1;
+         LL_total_r = Dr_total.m1 + Ir_total.m1;
+         LL_total_w = Dw_total.m1;
+      }
       VG_(umsg)(fmt, "LL refs:      ",
                      LL_total, LL_total_r, LL_total_w);
 
@@ -1650,6 +2536,28 @@ static void cg_fini(Int exitcode)
                 l1, LL_total_m  * 100.0 / (Ir_total.a + D_total.a),
                 l2, LL_total_mr * 100.0 / (Ir_total.a + Dr_total.a),
                 l3, LL_total_mw * 100.0 / Dw_total.a);
+
+      /* TLB results */
+      if (cachesim_has_TLB) {
+         VG_(umsg)("\n");
+         VG_(sprintf)(fmt, "%%s %%,%dllu\n", l1);
+         VG_(umsg)(fmt, "ITLB misses:  ", Ir_total.mT);
+         VG_(umsg)(fmt, "ITLB walks:   ", Ir_total.mW);
+         VG_(sprintf)(fmt, "%%s %%,%dllu  (%%,%dllu rd   + %%,%dllu wr)\n",
+                           l1, l2, l3);
+         VG_(umsg)(fmt, "DTLB misses:  ", Dr_total.mT + Dw_total.mT,
+                        Dr_total.mT, Dw_total.mT);
+         VG_(umsg)(fmt, "DTLB walks:   ", Dr_total.mW + Dw_total.mW,
+                        Dr_total.mW, Dw_total.mW);
+      }
+
+      if (clo_sample_period > 0) {
+         VG_(umsg)("\n");
+         VG_(umsg)("Misses were estimated from %llu sampled windows "
+                   "(%.1f%% of instrs).\n", sample_n_windows,
+                   sample_n_instrs > 0
+                   ? sample_n_counted * 100.0 / sample_n_instrs : 0.0);
+      }
    }
 
    /* If branch profiling is enabled, show branch overall results. */
@@ -1704,6 +2612,9 @@ static void cg_fini(Int exitcode)
                 VG_(OSetGen_Size)(CC_table));
       VG_(dmsg)("cachegrind: InstrInfo table size: %u\n",
                 VG_(OSetGen_Size)(instrInfoTable));
+      if (cachesim_prefetch != Pf_None)
+         VG_(dmsg)("cachegrind: D1 prefetches: %llu (%llu filled)\n",
+                   cachesim_n_prefetches, cachesim_n_prefetch_fills);
    }
 }
 
@@ -1727,6 +2638,10 @@ void cg_discard_superblock_info ( Addr orig_addr64, VexGuestExtents vge )
                    (void*)orig_addr,
                    (void*)vge.base[0], (ULong)vge.len[0]);
 
+   // Buffered events may refer to the InstrInfos about to be freed.
+   if (clo_cache_sim_buffer)
+      drain_event_buffer();
+
    // Get BB info, remove from table, free BB info.  Simple!  Note that we
    // use orig_addr, not the first instruction address in vge.
    sbInfo = VG_(OSetGen_Remove)(instrInfoTable, &orig_addr);
@@ -1740,14 +2655,44 @@ void cg_discard_superblock_info ( Addr orig_addr64, VexGuestExtents vge )
 
 static Bool cg_process_cmd_line_option(const HChar* arg)
 {
+   const HChar* tmp_str;
+
    if (VG_(str_clo_cache_opt)(arg,
                               &clo_I1_cache,
                               &clo_D1_cache,
                               &clo_LL_cache)) {}
+   else if (VG_(str_clo_mid_cache_opt)(arg, &clo_ML_cache)) {}
+   else if VG_STR_CLO(arg, "--ITLB", tmp_str)
+      parse_tlb_opt(&clo_ITLB, arg, tmp_str);
+   else if VG_STR_CLO(arg, "--DTLB", tmp_str)
+      parse_tlb_opt(&clo_DTLB, arg, tmp_str);
+   else if VG_STR_CLO(arg, "--STLB", tmp_str)
+      parse_tlb_opt(&clo_STLB, arg, tmp_str);
 
    else if VG_STR_CLO( arg, "--cachegrind-out-file", clo_cachegrind_out_file) {}
    else if VG_BOOL_CLO(arg, "--cache-sim",  clo_cache_sim)  {}
    else if VG_BOOL_CLO(arg, "--branch-sim", clo_branch_sim) {}
+   else if VG_BOOL_CLO(arg, "--tlb-sim",    clo_tlb_sim)    {}
+   else if VG_BOOL_CLO(arg, "--cache-sim-buffer", clo_cache_sim_buffer) {}
+   else if VG_BINT_CLO(arg, "--sample-period", clo_sample_period,
+                       0, 1000000000) {}
+   else if VG_BINT_CLO(arg, "--sample-window", clo_sample_window,
+                       1, 1000000000) {}
+   else if VG_BINT_CLO(arg, "--sample-warmup", clo_sample_warmup,
+                       0, 1000000000) {}
+   else if VG_XACT_CLO(arg, "--replacement-policy=lru",
+                       cachesim_repl, Repl_LRU) {}
+   else if VG_XACT_CLO(arg, "--replacement-policy=plru",
+                       cachesim_repl, Repl_PLRU) {}
+   else if VG_XACT_CLO(arg, "--replacement-policy=srrip",
+                       cachesim_repl, Repl_SRRIP) {}
+   else if VG_XACT_CLO(arg, "--D1-prefetch=none",
+                       cachesim_prefetch, Pf_None) {}
+   else if VG_XACT_CLO(arg, "--D1-prefetch=next-line",
+                       cachesim_prefetch, Pf_NextLine) {}
+   else if VG_XACT_CLO(arg, "--D1-prefetch=stride",
+                       cachesim_prefetch, Pf_Stride) {}
+   else if VG_BOOL_CLO(arg, "--per-thread-caches", clo_per_thread_caches) {}
    else
       return False;
 
@@ -1758,8 +2703,26 @@ static void cg_print_usage(void)
 {
    VG_(print_cache_clo_opts)();
    VG_(printf)(
+"    --ML=<size>,<assoc>,<line_size>  simulate a middle level cache (eg. L2)\n"
+"                                     between L1 and LL [none]\n"
+"    --replacement-policy=lru|plru|srrip  replacement policy of all the\n"
+"                                     simulated caches [lru]\n"
+"    --D1-prefetch=none|next-line|stride  simulated D1 prefetcher [none]\n"
+"    --per-thread-caches=yes|no [no]  give each thread its own I1, D1 and\n"
+"                                     ML, and only share LL?\n"
+"    --tlb-sim=yes|no [no]            collect TLB miss and page walk stats?\n"
+"    --ITLB=<entries>,<assoc>,<page_size>  set ITLB [128,8,4K]\n"
+"    --DTLB=<entries>,<assoc>,<page_size>  set DTLB [64,4,4K]\n"
+"    --STLB=<entries>,<assoc>,<page_size>  set second level TLB [1536,12,4K]\n"
 "    --cache-sim=yes|no  [yes]        collect cache stats?\n"
 "    --branch-sim=yes|no [no]         collect branch prediction stats?\n"
+"    --cache-sim-buffer=yes|no [no]   buffer accesses and simulate them in\n"
+"                                     batches (faster, same results)?\n"
+"    --sample-period=<number> [0]     if non-zero, only simulate the caches\n"
+"                                     in one window per <number> instrs,\n"
+"                                     and estimate the misses\n"
+"    --sample-window=<number> [100000]  instrs counted per window\n"
+"    --sample-warmup=<number> [100000]  instrs simulated before each window\n"
 "    --cachegrind-out-file=<file>     output file name [cachegrind.out.%%p]\n"
    );
 }
@@ -1801,9 +2764,26 @@ static void cg_pre_clo_init(void)
                                    cg_print_debug_usage);
 }
 
+/* With --per-thread-caches=yes, switch the private caches whenever a
+   different thread starts running. */
+static void cg_start_client_code(ThreadId tid, ULong blocks_dispatched)
+{
+   if (tid == cachesim_curr_tid)
+      return;
+   // Buffered accesses were made by the previous thread.
+   if (clo_cache_sim_buffer)
+      drain_event_buffer();
+   cachesim_switch_thread(tid);
+}
+
+static void cg_pre_thread_ll_create(ThreadId parent, ThreadId child)
+{
+   cachesim_reset_thread(child);
+}
+
 static void cg_post_clo_init(void)
 {
-   cache_t I1c, D1c, LLc; 
+   cache_t I1c, D1c, MLc, LLc; 
 
    CC_table =
       VG_(OSetGen_Create)(offsetof(LineCC, loc),
@@ -1831,6 +2811,13 @@ static void cg_post_clo_init(void)
    // cache lines at any cache level
    min_line_size = (I1c.line_size < D1c.line_size) ? I1c.line_size : D1c.line_size;
    min_line_size = (LLc.line_size < min_line_size) ? LLc.line_size : min_line_size;
+   MLc = clo_ML_cache;
+   if (MLc.size != -1) {
+      if (VG_(clo_verbosity) >= 2)
+         VG_(umsg)("  ML: %'d B, %d-way, %d B lines\n",
+                   MLc.size, MLc.assoc, MLc.line_size);
+      min_line_size = (MLc.line_size < min_line_size) ? MLc.line_size : min_line_size;
+   }
 
    Int largest_load_or_store_size
       = VG_(machine_get_size_of_largest_guest_register)();
@@ -1846,7 +2833,34 @@ static void cg_post_clo_init(void)
       VG_(exit)(1);
    }
 
-   cachesim_initcaches(I1c, D1c, LLc);
+   cachesim_initcaches(I1c, D1c, MLc, LLc);
+   if (clo_cache_sim && clo_tlb_sim)
+      cachesim_inittlbs(clo_ITLB, clo_DTLB, clo_STLB);
+
+   // Without cache simulation there is nothing to buffer or sample.
+   if (!clo_cache_sim) {
+      clo_cache_sim_buffer  = False;
+      clo_sample_period     = 0;
+      clo_per_thread_caches = False;
+   }
+   // The extended models are only simulated from the event buffer, or
+   // by the sampling helpers.
+   if (clo_cache_sim && cachesim_extended)
+      clo_cache_sim_buffer = True;
+   if (clo_per_thread_caches) {
+      VG_(track_start_client_code)(cg_start_client_code);
+      VG_(track_pre_thread_ll_create)(cg_pre_thread_ll_create);
+   }
+   if (clo_sample_period > 0) {
+      if (clo_sample_window + clo_sample_warmup > clo_sample_period)
+         VG_(fmsg_bad_option)("--sample-period",
+            "Must be at least --sample-window plus --sample-warmup\n");
+      clo_cache_sim_buffer = False;
+      sample_phase = SampleSkip;
+      sample_left  = clo_sample_period - clo_sample_warmup
+                                       - clo_sample_window;
+      sample_next_phase();
+   }
 }
 
 VG_DETERMINE_INTERFACE_VERSION(cg_pre_clo_init)
@@ -38,6 +38,33 @@
       - both blocks miss                 --> one miss (not two)
 */
 
+/* Replacement policies.  LRU keeps each set ordered from most to least
+   recently used.  The others leave the lines where they are and keep
+   some state for each line in a parallel array:
+   - PLRU (bit-PLRU, or "MRU bits") keeps one bit per line, set when the
+     line is used.  When the last clear bit of a set would be set, the
+     other bits are cleared.  The victim is the first line with a clear
+     bit.
+   - SRRIP keeps a 2-bit re-reference prediction value per line, which
+     a hit sets to 0 and a fill to 2.  The victim is the first line with
+     value 3; if there is none, all values are incremented until there
+     is. */
+typedef enum { Repl_LRU, Repl_PLRU, Repl_SRRIP } ReplPolicy;
+
+#define SRRIP_MAX 3
+
+/* Data prefetchers, which fill lines into D1 (and the levels below it)
+   without counting any access or miss:
+   - next-line: on a D1 miss, prefetch the next line.
+   - stride:    for each load/store instruction, remember the last
+                address and the stride from the one before; once the
+                same stride has been seen twice in a row, prefetch the
+                line one stride ahead. */
+typedef enum { Pf_None, Pf_NextLine, Pf_Stride } PrefetchKind;
+
+static ReplPolicy   cachesim_repl     = Repl_LRU;
+static PrefetchKind cachesim_prefetch = Pf_None;
+
 typedef struct {
    Int          size;                   /* bytes */
    Int          assoc;
@@ -48,13 +75,31 @@ typedef struct {
    Int          tag_shift;
    HChar        desc_line[128];         /* large enough */
    UWord*       tags;
+   UChar*       meta;                   /* per line; NULL for LRU */
 } cache_t2;
 
+/* Allocate and clear the per-line arrays for c.  with_meta says whether
+   c uses a replacement policy other than LRU. */
+static void cachesim_alloc_lines(cache_t2* c, Bool with_meta,
+                                 UWord** tags, UChar** meta)
+{
+   Int i, n_lines = c->sets * c->assoc;
+
+   *tags = VG_(malloc)("cg.sim.ci.1", sizeof(UWord) * n_lines);
+   for (i = 0; i < n_lines; i++)
+      (*tags)[i] = 0;
+
+   *meta = NULL;
+   if (with_meta) {
+      *meta = VG_(malloc)("cg.sim.ci.2", n_lines);
+      VG_(memset)(*meta, cachesim_repl == Repl_SRRIP ? SRRIP_MAX : 0,
+                  n_lines);
+   }
+}
+
 /* By this point, the size/assoc/line_size has been checked. */
 static void cachesim_initcache(cache_t config, cache_t2* c)
 {
-   Int i;
-
    c->size      = config.size;
    c->assoc     = config.assoc;
    c->line_size = config.line_size;
@@ -72,11 +117,61 @@ static void cachesim_initcache(cache_t config, cache_t2* c)
                                  c->size, c->line_size, c->assoc);
    }
 
-   c->tags = VG_(malloc)("cg.sim.ci.1",
-                         sizeof(UWord) * c->sets * c->assoc);
+   cachesim_alloc_lines(c, cachesim_repl != Repl_LRU, &c->tags, &c->meta);
+}
+
+/* The non-LRU policies; see ReplPolicy. */
+__attribute__((noinline))
+static Bool cachesim_setref_is_miss_meta(cache_t2* c, UInt set_no, UWord tag)
+{
+   Int    i, j;
+   UWord* set  = &(c->tags[set_no * c->assoc]);
+   UChar* meta = &(c->meta[set_no * c->assoc]);
+
+   if (cachesim_repl == Repl_PLRU) {
+      Bool miss = False;
+      for (i = 0; i < c->assoc; i++) {
+         if (tag == set[i])
+            break;
+      }
+      if (i == c->assoc) {
+         // All but one of the bits are always set, so this finds a
+         // victim -- except in a direct-mapped set, whose single bit
+         // stays set, so the last (only) way is taken.
+         for (i = 0; i < c->assoc - 1 && meta[i]; i++)
+            ;
+         set[i] = tag;
+         miss = True;
+      }
+      meta[i] = 1;
+      for (j = 0; j < c->assoc && meta[j]; j++)
+         ;
+      if (j == c->assoc) {
+         for (j = 0; j < c->assoc; j++)
+            meta[j] = 0;
+         meta[i] = 1;
+      }
+      return miss;
+   }
 
-   for (i = 0; i < c->sets * c->assoc; i++)
-      c->tags[i] = 0;
+   tl_assert(cachesim_repl == Repl_SRRIP);
+   for (i = 0; i < c->assoc; i++) {
+      if (tag == set[i]) {
+         meta[i] = 0;
+         return False;
+      }
+   }
+   while (True) {
+      for (i = 0; i < c->assoc; i++) {
+         if (meta[i] == SRRIP_MAX) {
+            set[i]  = tag;
+            meta[i] = SRRIP_MAX - 1;
+            return True;
+         }
+      }
+      for (i = 0; i < c->assoc; i++)
+         meta[i]++;
+   }
 }
 
 /* This attribute forces GCC to inline the function, getting rid of a
@@ -121,9 +216,21 @@ Bool cachesim_setref_is_miss(cache_t2* c, UInt set_no, UWord tag)
    return True;
 }
 
+/* Like cachesim_setref_is_miss, but for any replacement policy. */
+__attribute__((always_inline))
+static __inline__
+Bool cachesim_setref_is_miss_any(cache_t2* c, UInt set_no, UWord tag)
+{
+   if (c->meta != NULL)
+      return cachesim_setref_is_miss_meta(c, set_no, tag);
+   return cachesim_setref_is_miss(c, set_no, tag);
+}
+
+/* any_policy is constant at each call site.  The fast paths, which are
+ * only used for LRU, pass False, so that they stay free of calls. */
 __attribute__((always_inline))
 static __inline__
-Bool cachesim_ref_is_miss(cache_t2* c, Addr a, UChar size)
+Bool cachesim_ref_is_miss(cache_t2* c, Addr a, UChar size, Bool any_policy)
 {
    /* A memory block has the size of a cache line */
    UWord block1 =  a         >> c->line_size_bits;
@@ -141,7 +248,8 @@ Bool cachesim_ref_is_miss(cache_t2* c, Addr a, UChar size)
 
    /* Access entirely within line. */
    if (block1 == block2)
-      return cachesim_setref_is_miss(c, set1, tag1);
+      return any_policy ? cachesim_setref_is_miss_any(c, set1, tag1)
+                        : cachesim_setref_is_miss(c, set1, tag1);
 
    /* Access straddles two lines. */
    else if (block1 + 1 == block2) {
@@ -149,11 +257,11 @@ Bool cachesim_ref_is_miss(cache_t2* c, Addr a, UChar size)
       UWord tag2 = block2;
 
       /* always do both, as state is updated as side effect */
-      if (cachesim_setref_is_miss(c, set1, tag1)) {
-         cachesim_setref_is_miss(c, set2, tag2);
-         return True;
-      }
-      return cachesim_setref_is_miss(c, set2, tag2);
+      Bool miss1 = any_policy ? cachesim_setref_is_miss_any(c, set1, tag1)
+                              : cachesim_setref_is_miss(c, set1, tag1);
+      Bool miss2 = any_policy ? cachesim_setref_is_miss_any(c, set2, tag2)
+                              : cachesim_setref_is_miss(c, set2, tag2);
+      return miss1 || miss2;
    }
    VG_(printf)("addr: %lx  size: %u  blocks: %lu %lu",
                a, size, block1, block2);
@@ -164,23 +272,43 @@ Bool cachesim_ref_is_miss(cache_t2* c, Addr a, UChar size)
 
 
 static cache_t2 LL;
+static cache_t2 ML;     /* only used if cachesim_has_ML */
 static cache_t2 I1;
 static cache_t2 D1;
 
-static void cachesim_initcaches(cache_t I1c, cache_t D1c, cache_t LLc)
+static Bool cachesim_has_ML = False;
+
+/* Is a middle level, a replacement policy other than LRU, a prefetcher
+   or a TLB being simulated?  If so, references must go through the
+   cachesim_*_doref_any functions (and cachesim_TLB_doref) rather than
+   the fast paths, which only handle the original two-level LRU model. */
+static Bool cachesim_extended = False;
+
+static void cachesim_init_prefetcher(void);
+
+static void cachesim_initcaches(cache_t I1c, cache_t D1c, cache_t MLc,
+                                cache_t LLc)
 {
    cachesim_initcache(I1c, &I1);
    cachesim_initcache(D1c, &D1);
+   cachesim_has_ML = MLc.size != -1;
+   if (cachesim_has_ML)
+      cachesim_initcache(MLc, &ML);
    cachesim_initcache(LLc, &LL);
+   cachesim_init_prefetcher();
+
+   cachesim_extended = cachesim_has_ML
+                       || cachesim_repl != Repl_LRU
+                       || cachesim_prefetch != Pf_None;
 }
 
 __attribute__((always_inline))
 static __inline__
 void cachesim_I1_doref_Gen(Addr a, UChar size, ULong* m1, ULong *mL)
 {
-   if (cachesim_ref_is_miss(&I1, a, size)) {
+   if (cachesim_ref_is_miss(&I1, a, size, False)) {
       (*m1)++;
-      if (cachesim_ref_is_miss(&LL, a, size))
+      if (cachesim_ref_is_miss(&LL, a, size, False))
          (*mL)++;
    }
 }
@@ -207,13 +335,303 @@ __attribute__((always_inline))
 static __inline__
 void cachesim_D1_doref(Addr a, UChar size, ULong* m1, ULong *mL)
 {
-   if (cachesim_ref_is_miss(&D1, a, size)) {
+   if (cachesim_ref_is_miss(&D1, a, size, False)) {
       (*m1)++;
-      if (cachesim_ref_is_miss(&LL, a, size))
+      if (cachesim_ref_is_miss(&LL, a, size, False))
          (*mL)++;
    }
 }
 
+/* Reference the levels below an L1 cache which missed. */
+static void cachesim_below_L1_doref_any(Addr a, UChar size,
+                                        ULong* mM, ULong *mL)
+{
+   if (cachesim_has_ML) {
+      if (!cachesim_ref_is_miss(&ML, a, size, True))
+         return;
+      (*mM)++;
+   }
+   if (cachesim_ref_is_miss(&LL, a, size, True))
+      (*mL)++;
+}
+
+__attribute__((noinline))
+static void cachesim_I1_doref_any(Addr a, UChar size,
+                                  ULong* m1, ULong* mM, ULong *mL)
+{
+   if (cachesim_ref_is_miss(&I1, a, size, True)) {
+      (*m1)++;
+      cachesim_below_L1_doref_any(a, size, mM, mL);
+   }
+}
+
+/* Prefetcher state.  The stride table is indexed by a hash of the
+   address of the load/store instruction. */
+#define PF_STRIDE_ENTRIES 256
+
+typedef struct {
+   Addr  pc;
+   Addr  last;
+   Word  stride;
+   UInt  conf;
+} PfStrideEntry;
+
+static PfStrideEntry* pf_stride_table;
+
+static ULong cachesim_n_prefetches;      /* prefetches issued */
+static ULong cachesim_n_prefetch_fills;  /* of which missed D1 */
+
+static void cachesim_init_prefetcher(void)
+{
+   if (cachesim_prefetch == Pf_Stride) {
+      pf_stride_table = VG_(calloc)("cg.sim.ip.1", PF_STRIDE_ENTRIES,
+                                    sizeof(PfStrideEntry));
+   }
+}
+
+/* Bring the line holding a into D1 and the levels below it, without
+   counting anything. */
+static void cachesim_D1_fill(Addr a)
+{
+   ULong dummy_mM, dummy_mL;
+
+   cachesim_n_prefetches++;
+   if (cachesim_ref_is_miss(&D1, a, 1, True)) {
+      cachesim_n_prefetch_fills++;
+      cachesim_below_L1_doref_any(a, 1, &dummy_mM, &dummy_mL);
+   }
+}
+
+static void cachesim_D1_prefetch(Addr pc, Addr a, Bool miss)
+{
+   UWord block = a >> D1.line_size_bits;
+
+   if (cachesim_prefetch == Pf_NextLine) {
+      if (miss)
+         cachesim_D1_fill((block + 1) << D1.line_size_bits);
+   } else {
+      PfStrideEntry* e
+         = &pf_stride_table[(pc ^ (pc >> 8)) & (PF_STRIDE_ENTRIES - 1)];
+      Word stride = a - e->last;
+
+      tl_assert(cachesim_prefetch == Pf_Stride);
+      if (e->pc != pc) {
+         e->pc     = pc;
+         e->stride = 0;
+         e->conf   = 0;
+      } else if (stride != 0 && stride == e->stride) {
+         if (e->conf < 2)
+            e->conf++;
+      } else {
+         e->stride = stride;
+         e->conf   = 0;
+      }
+      e->last = a;
+      if (e->conf == 2 && ((a + e->stride) >> D1.line_size_bits) != block)
+         cachesim_D1_fill(a + e->stride);
+   }
+}
+
+/* pc is the address of the instruction making the access; it is only
+   used by the stride prefetcher. */
+__attribute__((noinline))
+static void cachesim_D1_doref_any(Addr pc, Addr a, UChar size,
+                                  ULong* m1, ULong* mM, ULong *mL)
+{
+   Bool miss = cachesim_ref_is_miss(&D1, a, size, True);
+
+   if (miss) {
+      (*m1)++;
+      cachesim_below_L1_doref_any(a, size, mM, mL);
+   }
+   if (cachesim_prefetch != Pf_None)
+      cachesim_D1_prefetch(pc, a, miss);
+}
+
+/* TLBs.  A TLB is simulated as an LRU cache of translations, whose
+   lines are pages, so the code above does the lookups.  An access which
+   misses in the ITLB or the DTLB looks up the second level STLB, which
+   they share, and a miss in that needs a page walk.  The memory
+   accesses made by the walk itself are not simulated.  The TLBs always
+   use LRU replacement, whatever the policy of the caches. */
+typedef struct {
+   Int entries;
+   Int assoc;
+   Int page_size;       /* bytes */
+} tlb_t;
+
+static cache_t2 ITLB;
+static cache_t2 DTLB;
+static cache_t2 STLB;
+
+static Bool cachesim_has_TLB = False;
+
+static void cachesim_inittlb(tlb_t config, cache_t2* c)
+{
+   const HChar* unit = "KB";
+   Int          size = config.page_size >> 10;
+
+   if (size >= 1024) { size >>= 10; unit = "MB"; }
+   if (size >= 1024) { size >>= 10; unit = "GB"; }
+
+   c->size           = config.entries;   /* in entries, not bytes */
+   c->assoc          = config.assoc;
+   c->line_size      = config.page_size;
+   c->sets           = config.entries / config.assoc;
+   c->sets_min_1     = c->sets - 1;
+   c->line_size_bits = VG_(log2)(c->line_size);
+   c->tag_shift      = c->line_size_bits + VG_(log2)(c->sets);
+
+   if (c->assoc == 1) {
+      VG_(sprintf)(c->desc_line, "%d entries, %d %s pages, direct-mapped",
+                                 c->size, size, unit);
+   } else {
+      VG_(sprintf)(c->desc_line,
+                   "%d entries, %d %s pages, %d-way associative",
+                   c->size, size, unit, c->assoc);
+   }
+
+   cachesim_alloc_lines(c, False, &c->tags, &c->meta);
+}
+
+/* By this point, the TLB configurations have been checked. */
+static void cachesim_inittlbs(tlb_t ITLBc, tlb_t DTLBc, tlb_t STLBc)
+{
+   cachesim_inittlb(ITLBc, &ITLB);
+   cachesim_inittlb(DTLBc, &DTLB);
+   cachesim_inittlb(STLBc, &STLB);
+   cachesim_has_TLB  = True;
+   cachesim_extended = True;
+}
+
+/* Translate an access through tlb, the ITLB or the DTLB.  Only used if
+   cachesim_has_TLB. */
+static void cachesim_TLB_doref(cache_t2* tlb, Addr a, UChar size,
+                               ULong* mT, ULong* mW)
+{
+   if (cachesim_ref_is_miss(tlb, a, size, False)) {
+      (*mT)++;
+      if (cachesim_ref_is_miss(&STLB, a, size, False))
+         (*mW)++;
+   }
+}
+
+/* The per-thread state with --per-thread-caches=yes: each thread has
+   its own I1, D1 and ML contents, TLBs and prefetcher, and only LL is
+   shared.  Only one thread runs at a time, so the contents of the
+   current thread are simply swapped in on a thread switch. */
+#define N_PRIVATE_CACHES 6
+
+typedef struct {
+   UWord*         tags[N_PRIVATE_CACHES];   /* I1, D1, ML, ITLB, DTLB, STLB */
+   UChar*         meta[N_PRIVATE_CACHES];
+   PfStrideEntry* pf_stride_table;
+} ThreadCaches;
+
+static ThreadCaches* thread_caches;       /* indexed by ThreadId */
+static UInt          n_thread_caches;
+static ThreadId      cachesim_curr_tid = 1;
+
+static ThreadCaches* cachesim_thread_caches(ThreadId tid)
+{
+   if (tid >= n_thread_caches) {
+      UInt i, n = tid + 8;
+      thread_caches = VG_(realloc)("cg.sim.ttc.1", thread_caches,
+                                   n * sizeof(ThreadCaches));
+      for (i = n_thread_caches; i < n; i++)
+         VG_(memset)(&thread_caches[i], 0, sizeof(ThreadCaches));
+      n_thread_caches = n;
+   }
+   return &thread_caches[tid];
+}
+
+/* Empty the contents of c, which are in use by the current thread. */
+static void cachesim_clear_lines(cache_t2* c)
+{
+   Int n_lines = c->sets * c->assoc;
+
+   VG_(memset)(c->tags, 0, sizeof(UWord) * n_lines);
+   if (c->meta)
+      VG_(memset)(c->meta, cachesim_repl == Repl_SRRIP ? SRRIP_MAX : 0,
+                  n_lines);
+}
+
+/* Give the (new) thread tid empty private caches. */
+static void cachesim_reset_thread(ThreadId tid)
+{
+   static Bool seen_first_thread = False;
+   ThreadCaches* tc = cachesim_thread_caches(tid);
+   Int i;
+
+   if (tid == cachesim_curr_tid) {
+      // The first thread starts with the caches allocated at start-up.
+      // A later thread can get the ThreadId of a dead thread which was
+      // the last to run, whose contents are still the live ones.
+      if (seen_first_thread) {
+         cachesim_clear_lines(&I1);
+         cachesim_clear_lines(&D1);
+         if (cachesim_has_ML)
+            cachesim_clear_lines(&ML);
+         if (cachesim_has_TLB) {
+            cachesim_clear_lines(&ITLB);
+            cachesim_clear_lines(&DTLB);
+            cachesim_clear_lines(&STLB);
+         }
+         if (pf_stride_table)
+            VG_(memset)(pf_stride_table, 0,
+                        PF_STRIDE_ENTRIES * sizeof(PfStrideEntry));
+      }
+      seen_first_thread = True;
+      return;
+   }
+   seen_first_thread = True;
+   for (i = 0; i < N_PRIVATE_CACHES; i++) {
+      if (tc->tags[i]) VG_(free)(tc->tags[i]);
+      if (tc->meta[i]) VG_(free)(tc->meta[i]);
+   }
+   if (tc->pf_stride_table) VG_(free)(tc->pf_stride_table);
+   VG_(memset)(tc, 0, sizeof(ThreadCaches));
+}
+
+static void cachesim_switch_thread(ThreadId tid)
+{
+   cache_t2*     c[N_PRIVATE_CACHES] = { &I1, &D1, &ML, &ITLB, &DTLB, &STLB };
+   Bool          used[N_PRIVATE_CACHES]
+      = { True, True, cachesim_has_ML,
+          cachesim_has_TLB, cachesim_has_TLB, cachesim_has_TLB };
+   ThreadCaches* tc;
+   Int           i;
+
+   if (tid == cachesim_curr_tid)
+      return;
+
+   tc = cachesim_thread_caches(cachesim_curr_tid);
+   for (i = 0; i < N_PRIVATE_CACHES; i++) {
+      if (!used[i])
+         continue;
+      tc->tags[i] = c[i]->tags;
+      tc->meta[i] = c[i]->meta;
+   }
+   tc->pf_stride_table = pf_stride_table;
+
+   tc = cachesim_thread_caches(tid);
+   for (i = 0; i < N_PRIVATE_CACHES; i++) {
+      if (!used[i])
+         continue;
+      if (tc->tags[i] == NULL)
+         cachesim_alloc_lines(c[i], c[i]->meta != NULL,
+                              &tc->tags[i], &tc->meta[i]);
+      c[i]->tags = tc->tags[i];
+      c[i]->meta = tc->meta[i];
+   }
+   if (cachesim_prefetch == Pf_Stride && tc->pf_stride_table == NULL)
+      tc->pf_stride_table = VG_(calloc)("cg.sim.st.1", PF_STRIDE_ENTRIES,
+                                        sizeof(PfStrideEntry));
+   pf_stride_table = tc->pf_stride_table;
+   VG_(memset)(tc, 0, sizeof(ThreadCaches));
+   cachesim_curr_tid = tid;
+}
+
 /* Check for special case IrNoX. Called at instrumentation time.
  *
  * Does this Ir only touch one cache line, and are L1I/LL cache
@@ -233,6 +651,26 @@ static Bool cachesim_is_IrNoX(Addr a, UChar size)
    return True;
 }
 
+/* Called at instrumentation time.  Is an instruction read of size
+ * bytes at a, done straight after one of prev_size bytes at prev_a,
+ * certain to hit the line which that read left as the most recently
+ * used of its I1 set?  Such a read cannot change the state of any
+ * cache, so only its Ir count needs to be incremented.
+ */
+static Bool cachesim_I1_is_MRU_hit(Addr prev_a, UChar prev_size,
+                                   Addr a, UChar size)
+{
+   UWord prev_block = (prev_a+prev_size-1) >> I1.line_size_bits;
+
+   // Under LRU and PLRU, a hit on the line that was just used leaves
+   // the state of its set unchanged.  Under SRRIP it does not: the
+   // first hit after a fill lowers the line's RRPV to 0.
+   if (cachesim_repl == Repl_SRRIP)
+      return False;
+   return (a         >> I1.line_size_bits) == prev_block
+       && ((a+size-1) >> I1.line_size_bits) == prev_block;
+}
+
 /*--------------------------------------------------------------------*/
 /*--- end                                                 cg_sim.c ---*/
 /*--------------------------------------------------------------------*/
@@ -0,0 +1,103 @@
+/*--------------------------------------------------------------------*/
+/*--- Callgrind                                                    ---*/
+/*---                                                  binformat.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Callgrind, a Valgrind tool for call tracing.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* Layout of profile dumps written with --dump-format=binary.
+ * Shared by callgrind/dump.c and auxprogs/callgrind_bin2text.c,
+ * so this header must only use plain C.
+ *
+ * A binary dump is a text dump in which the first line is replaced
+ * by CLGB_MAGIC and the cost part of every dump part (everything
+ * between the "summary:" and the "totals:" lines) is replaced by a
+ * binary body:
+ *
+ *   CLGB_BODY <flags byte> <record>* CLGB_END
+ *
+ * As text never contains a NUL byte, CLGB_BODY (0) marks the start
+ * of a body.  Each record starts with an opcode byte.  Numbers are
+ * unsigned LEB128 varints ("uleb"); signed numbers are zigzag encoded
+ * before ("sleb").
+ *
+ *  CLGB_TAG_*  name line "<tag>=...": uleb v; v==0: a full name
+ *              follows, else id = (v-1)>>1, and if (v-1)&1 the name
+ *              for the id follows.  A name is uleb length + bytes.
+ *  CLGB_COST   <pos> <costs>: a cost line.  Afterwards, the last
+ *              position is set to the position of this line.
+ *  CLGB_CALLS  uleb count, <pos> target, <pos> <costs>
+ *  CLGB_JUMP   uleb count, <pos> target, <pos>
+ *  CLGB_JCND   uleb followed, uleb executed, <pos> target, <pos>
+ *  CLGB_NEWFN  resets the last position to 0
+ *  CLGB_TEXT   a NUL terminated piece of text, written as is
+ *
+ * <pos> is one sleb per position kind enabled in the flags (in the
+ * order instr, bb, line), giving the difference to the last position.
+ * <costs> is uleb n and n ulebs; trailing zero costs are left out.
+ */
+
+#ifndef CLG_BINFORMAT
+#define CLG_BINFORMAT
+
+#define CLGB_MAGIC "# callgrind binary format 1\n"
+
+/* Record opcodes */
+#define CLGB_BODY    0
+#define CLGB_END     1
+#define CLGB_COST    2
+#define CLGB_CALLS   3
+#define CLGB_JUMP    4
+#define CLGB_JCND    5
+#define CLGB_NEWFN   6
+#define CLGB_TEXT    7
+
+/* Name tags; the values are opcodes, too */
+#define CLGB_TAG_OB     16
+#define CLGB_TAG_FL     17
+#define CLGB_TAG_FI     18
+#define CLGB_TAG_FE     19
+#define CLGB_TAG_FN     20
+#define CLGB_TAG_COB    21
+#define CLGB_TAG_CFI    22
+#define CLGB_TAG_CFN    23
+#define CLGB_TAG_JFI    24
+#define CLGB_TAG_JFN    25
+#define CLGB_TAG_FRFN   26
+#define CLGB_TAG_FIRST  CLGB_TAG_OB
+#define CLGB_TAG_LAST   CLGB_TAG_FRFN
+
+#define CLGB_TAG_NAMES \
+   { "ob", "fl", "fi", "fe", "fn", "cob", "cfi", "cfn", "jfi", "jfn", "frfn" }
+
+/* Body flags */
+#define CLGB_FLAG_INSTR     1   /* positions: instr */
+#define CLGB_FLAG_BB        2   /* positions: bb */
+#define CLGB_FLAG_LINE      4   /* positions: line */
+#define CLGB_FLAG_COMPRESS  8   /* --compress-pos=yes */
+#define CLGB_FLAG_ADDR64   16   /* addresses are 64 bit */
+
+#endif /* CLG_BINFORMAT */
+
+/*--------------------------------------------------------------------*/
+/*--- end                                              binformat.h ---*/
+/*--------------------------------------------------------------------*/
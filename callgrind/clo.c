@@ -521,6 +521,10 @@ Bool CLG_(process_cmd_line_option)(const HChar* arg)
    else if VG_BOOL_CLO(arg, "--dump-line",  CLG_(clo).dump_line) {}
    else if VG_BOOL_CLO(arg, "--dump-instr", CLG_(clo).dump_instr) {}
    else if VG_BOOL_CLO(arg, "--dump-bb",    CLG_(clo).dump_bb) {}
+   else if VG_XACT_CLO(arg, "--dump-format=text",
+                            CLG_(clo).dump_binary, False) {}
+   else if VG_XACT_CLO(arg, "--dump-format=binary",
+                            CLG_(clo).dump_binary, True) {}
 
    else if VG_INT_CLO( arg, "--dump-every-bb", CLG_(clo).dump_every_bb) {}
 
@@ -556,6 +560,8 @@ void CLG_(print_usage)(void)
 "    --compress-strings=no|yes Compress strings in profile dump? [yes]\n"
 "    --compress-pos=no|yes     Compress positions in profile dump? [yes]\n"
 "    --combine-dumps=no|yes    Concat all dumps into same file [no]\n"
+"    --dump-format=text|binary Format of the profile dump [text]\n"
+"                              (convert binary dumps with callgrind_bin2text)\n"
 #if CLG_EXPERIMENTAL
 "    --compress-events=no|yes  Compress events in profile dump? [no]\n"
 "    --dump-bb=no|yes          Dump basic block address of costs? [no]\n"
@@ -639,6 +645,7 @@ void CLG_(set_clo_defaults)(void)
   CLG_(clo).dump_line        = True;
   CLG_(clo).dump_instr       = False;
   CLG_(clo).dump_bb          = False;
+  CLG_(clo).dump_binary      = False;
   CLG_(clo).dump_bbs         = False;
 
   CLG_(clo).dump_every_bb    = 0;
@@ -32,6 +32,8 @@
 #include "pub_tool_threadstate.h"
 #include "pub_tool_libcfile.h"
 
+#include "binformat.h"
+
 
 /* Dump Part Counter */
 static Int out_counter = 0;
@@ -124,18 +126,179 @@ void init_fpos(FnPos* p)
 }
 
 
-static void print_obj(VgFile *fp, const HChar* prefix, obj_node* obj)
+/*------------------------------------------------------------*/
+/*--- Binary dump format (--dump-format=binary)            ---*/
+/*------------------------------------------------------------*/
+
+/* For the layout, see binformat.h. Records are collected in bin_buf
+ * and written to the dump file in big chunks.
+ * Before writing a record, space for it has to be reserved with
+ * bin_reserve(); numbers take at most BIN_MAXNUM bytes.
+ */
+#define BIN_BUFSIZE 65536
+#define BIN_MAXNUM  10
+
+static UChar*  bin_buf = 0;
+static UInt    bin_used = 0;
+static VgFile* bin_fp = 0;
+
+static const HChar* tag_names[] = CLGB_TAG_NAMES;
+#define TAG_NAME(tag) tag_names[(tag) - CLGB_TAG_FIRST]
+
+static void bin_flush(void)
 {
-    if (CLG_(clo).compress_strings) {
+    if (bin_used > 0)
+	VG_(fwrite)(bin_fp, bin_buf, bin_used);
+    bin_used = 0;
+}
+
+static __inline__
+void bin_reserve(UInt bytes)
+{
+    CLG_ASSERT(bytes <= BIN_BUFSIZE);
+    if (bin_used + bytes > BIN_BUFSIZE)
+	bin_flush();
+}
+
+static __inline__
+void bin_byte(UChar b)
+{
+    bin_buf[bin_used++] = b;
+}
+
+static __inline__
+void bin_uleb(ULong v)
+{
+    while (v >= 0x80) {
+	bin_buf[bin_used++] = (UChar)(v | 0x80);
+	v >>= 7;
+    }
+    bin_buf[bin_used++] = (UChar)v;
+}
+
+/* zigzag encoding: small negative numbers get small codes, too */
+static __inline__
+void bin_sleb(Long v)
+{
+    bin_uleb(((ULong)v << 1) ^ (ULong)(v >> 63));
+}
+
+static void bin_bytes(const HChar* p, SizeT len)
+{
+    while (len > 0) {
+	SizeT n = BIN_BUFSIZE - bin_used;
+	if (n == 0) {
+	    bin_flush();
+	    continue;
+	}
+	if (n > len) n = len;
+	VG_(memcpy)(bin_buf + bin_used, p, n);
+	bin_used += n;
+	p += n;
+	len -= n;
+    }
+}
+
+static void bin_string(const HChar* s)
+{
+    SizeT len = VG_(strlen)(s);
+
+    bin_reserve(BIN_MAXNUM);
+    bin_uleb(len);
+    bin_bytes(s, len);
+}
+
+/* Start a name record. If <compressed>, the name is referenced by <id>.
+ * If <with_name>, the caller has to append the name.
+ */
+static void bin_name(UChar tag, Bool compressed, UInt id, Bool with_name)
+{
+    CLG_ASSERT(compressed || with_name);
+
+    bin_reserve(1 + BIN_MAXNUM);
+    bin_byte(tag);
+    bin_uleb(compressed ? ((((ULong)id) << 1) | with_name) + 1 : 0);
+}
+
+/* Start the binary body of a dump part, following the header */
+static void bin_start(VgFile* fp)
+{
+    UChar flags = 0;
+
+    if (bin_buf == 0)
+	bin_buf = CLG_MALLOC("cl.dump.bs.1", BIN_BUFSIZE);
+    bin_fp = fp;
+    bin_used = 0;
+
+    if (CLG_(clo).dump_instr)   flags |= CLGB_FLAG_INSTR;
+    if (CLG_(clo).dump_bb)      flags |= CLGB_FLAG_BB;
+    if (CLG_(clo).dump_line)    flags |= CLGB_FLAG_LINE;
+    if (CLG_(clo).compress_pos) flags |= CLGB_FLAG_COMPRESS;
+    if (sizeof(Addr) == 8)      flags |= CLGB_FLAG_ADDR64;
+
+    bin_byte(CLGB_BODY);
+    bin_byte(flags);
+}
+
+static void bin_end(void)
+{
+    bin_reserve(1);
+    bin_byte(CLGB_END);
+    bin_flush();
+    bin_fp = 0;
+}
+
+static void bin_add_char(HChar c, void* opaque)
+{
+    if (bin_used == BIN_BUFSIZE)
+	bin_flush();
+    bin_buf[bin_used++] = c;
+}
+
+/* Print into the dump. With binary format, this writes a text record,
+ * which is used for lines without a binary representation.
+ */
+static void dump_printf(VgFile *fp, const HChar* format, ...)
+    PRINTF_CHECK(2, 3);
+
+static void dump_printf(VgFile *fp, const HChar* format, ...)
+{
+    va_list vargs;
+
+    va_start(vargs, format);
+    if (CLG_(clo).dump_binary) {
+	bin_reserve(1);
+	bin_byte(CLGB_TEXT);
+	VG_(vcbprintf)(bin_add_char, 0, format, vargs);
+	bin_add_char('\0', 0);
+    }
+    else
+	VG_(vfprintf)(fp, format, vargs);
+    va_end(vargs);
+}
+
+
+/*
+ * tag can be CLGB_TAG_OB, CLGB_TAG_COB
+ */
+static void print_obj(VgFile *fp, UChar tag, obj_node* obj)
+{
+    if (CLG_(clo).dump_binary) {
+	Bool with_name = !CLG_(clo).compress_strings || !obj_dumped[obj->number];
+	bin_name(tag, CLG_(clo).compress_strings, obj->number, with_name);
+	if (with_name) bin_string(obj->name);
+    }
+    else if (CLG_(clo).compress_strings) {
 	CLG_ASSERT(obj_dumped != 0);
 	if (obj_dumped[obj->number])
-            VG_(fprintf)(fp, "%s(%u)\n", prefix, obj->number);
+            VG_(fprintf)(fp, "%s=(%u)\n", TAG_NAME(tag), obj->number);
 	else {
-            VG_(fprintf)(fp, "%s(%u) %s\n", prefix, obj->number, obj->name);
+            VG_(fprintf)(fp, "%s=(%u) %s\n", TAG_NAME(tag),
+			 obj->number, obj->name);
 	}
     }
     else
-        VG_(fprintf)(fp, "%s%s\n", prefix, obj->name);
+        VG_(fprintf)(fp, "%s=%s\n", TAG_NAME(tag), obj->name);
 
 #if 0
     /* add mapping parameters the first time a object is dumped
@@ -150,27 +313,46 @@ static void print_obj(VgFile *fp, const HChar* prefix, obj_node* obj)
 #endif
 }
 
-static void print_file(VgFile *fp, const char *prefix, const file_node* file)
+/*
+ * tag can be CLGB_TAG_FL, CLGB_TAG_FI, CLGB_TAG_FE, CLGB_TAG_CFI, CLGB_TAG_JFI
+ */
+static void print_file(VgFile *fp, UChar tag, const file_node* file)
 {
-    if (CLG_(clo).compress_strings) {
+    if (CLG_(clo).dump_binary) {
+	Bool with_name = !CLG_(clo).compress_strings ||
+			 !file_dumped[file->number];
+	bin_name(tag, CLG_(clo).compress_strings, file->number, with_name);
+	if (with_name) bin_string(file->name);
+	file_dumped[file->number] = True;
+    }
+    else if (CLG_(clo).compress_strings) {
 	CLG_ASSERT(file_dumped != 0);
 	if (file_dumped[file->number])
-            VG_(fprintf)(fp, "%s(%u)\n", prefix, file->number);
+            VG_(fprintf)(fp, "%s=(%u)\n", TAG_NAME(tag), file->number);
 	else {
-            VG_(fprintf)(fp, "%s(%u) %s\n", prefix, file->number, file->name);
+            VG_(fprintf)(fp, "%s=(%u) %s\n", TAG_NAME(tag),
+			 file->number, file->name);
 	    file_dumped[file->number] = True;
 	}
     }
     else
-        VG_(fprintf)(fp, "%s%s\n", prefix, file->name);
+        VG_(fprintf)(fp, "%s=%s\n", TAG_NAME(tag), file->name);
 }
 
 /*
- * tag can be "fn", "cfn", "jfn"
+ * tag can be CLGB_TAG_FN, CLGB_TAG_CFN, CLGB_TAG_JFN, CLGB_TAG_FRFN
  */
-static void print_fn(VgFile *fp, const HChar* tag, const fn_node* fn)
+static void print_fn(VgFile *fp, UChar tag, const fn_node* fn)
 {
-    VG_(fprintf)(fp, "%s=",tag);
+    if (CLG_(clo).dump_binary) {
+	Bool with_name = !CLG_(clo).compress_strings || !fn_dumped[fn->number];
+	bin_name(tag, CLG_(clo).compress_strings, fn->number, with_name);
+	if (with_name) bin_string(fn->name);
+	fn_dumped[fn->number] = True;
+	return;
+    }
+
+    VG_(fprintf)(fp, "%s=", TAG_NAME(tag));
     if (CLG_(clo).compress_strings) {
 	CLG_ASSERT(fn_dumped != 0);
 	if (fn_dumped[fn->number])
@@ -184,7 +366,32 @@ static void print_fn(VgFile *fp, const HChar* tag, const fn_node* fn)
         VG_(fprintf)(fp, "%s\n", fn->name);
 }
 
-static void print_mangled_fn(VgFile *fp, const HChar* tag, 
+/* Append the mangled name of a context to a binary name record */
+static void bin_mangled_name(Context* cxt, int rec_index)
+{
+    HChar rec[16];
+    SizeT len;
+    int i;
+
+    rec[0] = '\0';
+    if (rec_index >0)
+	VG_(sprintf)(rec, "'%d", rec_index +1);
+
+    len = VG_(strlen)(cxt->fn[0]->name) + VG_(strlen)(rec);
+    for(i=1;i<cxt->size;i++)
+	len += 1 + VG_(strlen)(cxt->fn[i]->name);
+
+    bin_reserve(BIN_MAXNUM);
+    bin_uleb(len);
+    bin_bytes(cxt->fn[0]->name, VG_(strlen)(cxt->fn[0]->name));
+    bin_bytes(rec, VG_(strlen)(rec));
+    for(i=1;i<cxt->size;i++) {
+	bin_bytes("'", 1);
+	bin_bytes(cxt->fn[i]->name, VG_(strlen)(cxt->fn[i]->name));
+    }
+}
+
+static void print_mangled_fn(VgFile *fp, UChar tag,
 			     Context* cxt, int rec_index)
 {
     int i;
@@ -196,8 +403,8 @@ static void print_mangled_fn(VgFile *fp, const HChar* tag,
 
 	CLG_ASSERT(cxt_dumped != 0);
 	if (cxt_dumped[cxt->base_number+rec_index]) {
-            VG_(fprintf)(fp, "%s=(%u)\n",
-			     tag, cxt->base_number + rec_index);
+            dump_printf(fp, "%s=(%u)\n",
+			TAG_NAME(tag), cxt->base_number + rec_index);
 	    return;
 	}
 
@@ -207,8 +414,8 @@ static void print_mangled_fn(VgFile *fp, const HChar* tag,
 	    CLG_ASSERT(cxt->fn[i-1]->pure_cxt != 0);
 	    n = cxt->fn[i-1]->pure_cxt->base_number;
 	    if (cxt_dumped[n]) continue;
-	    VG_(fprintf)(fp, "%s=(%d) %s\n",
-			     tag, n, cxt->fn[i-1]->name);
+	    dump_printf(fp, "%s=(%d) %s\n",
+			TAG_NAME(tag), n, cxt->fn[i-1]->name);
 
 	    cxt_dumped[n] = True;
 	    last = cxt->fn[i-1]->pure_cxt;
@@ -216,22 +423,31 @@ static void print_mangled_fn(VgFile *fp, const HChar* tag,
 	/* If the last context was the context to print, we are finished */
 	if ((last == cxt) && (rec_index == 0)) return;
 
-	VG_(fprintf)(fp, "%s=(%u) (%u)", tag,
-			 cxt->base_number + rec_index,
-			 cxt->fn[0]->pure_cxt->base_number);
+	dump_printf(fp, "%s=(%u) (%u)", TAG_NAME(tag),
+		    cxt->base_number + rec_index,
+		    cxt->fn[0]->pure_cxt->base_number);
 	if (rec_index >0)
-	    VG_(fprintf)(fp, "'%d", rec_index +1);
+	    dump_printf(fp, "'%d", rec_index +1);
 	for(i=1;i<cxt->size;i++)
-	    VG_(fprintf)(fp, "'(%u)", 
-			      cxt->fn[i]->pure_cxt->base_number);
-	VG_(fprintf)(fp, "\n");
+	    dump_printf(fp, "'(%u)",
+			cxt->fn[i]->pure_cxt->base_number);
+	dump_printf(fp, "\n");
 
 	cxt_dumped[cxt->base_number+rec_index] = True;
 	return;
     }
 
+    if (CLG_(clo).dump_binary) {
+	UInt id = cxt->base_number + rec_index;
+	Bool with_name = !CLG_(clo).compress_strings || !cxt_dumped[id];
 
-    VG_(fprintf)(fp, "%s=", tag);
+	bin_name(tag, CLG_(clo).compress_strings, id, with_name);
+	if (with_name) bin_mangled_name(cxt, rec_index);
+	cxt_dumped[id] = True;
+	return;
+    }
+
+    VG_(fprintf)(fp, "%s=", TAG_NAME(tag));
     if (CLG_(clo).compress_strings) {
 	CLG_ASSERT(cxt_dumped != 0);
 	if (cxt_dumped[cxt->base_number+rec_index]) {
@@ -273,7 +489,7 @@ static Bool print_fn_pos(VgFile *fp, FnPos* last, BBCC* bbcc)
 
     if (!CLG_(clo).mangle_names) {
 	if (last->rec_index != bbcc->rec_index) {
-	    VG_(fprintf)(fp, "rec=%u\n\n", bbcc->rec_index);
+	    dump_printf(fp, "rec=%u\n\n", bbcc->rec_index);
 	    last->rec_index = bbcc->rec_index;
 	    last->cxt = 0; /* reprint context */
 	    res = True;
@@ -287,12 +503,12 @@ static Bool print_fn_pos(VgFile *fp, FnPos* last, BBCC* bbcc)
 	    if (curr_from == 0) {
 		if (last_from != 0) {
 		    /* switch back to no context */
-		    VG_(fprintf)(fp, "frfn=(spontaneous)\n");
+		    dump_printf(fp, "frfn=(spontaneous)\n");
 		    res = True;
 		}
 	    }
 	    else if (last_from != curr_from) {
-		print_fn(fp, "frfn", curr_from);
+		print_fn(fp, CLGB_TAG_FRFN, curr_from);
 		res = True;
 	    }
 	    last->cxt = bbcc->cxt;
@@ -300,20 +516,20 @@ static Bool print_fn_pos(VgFile *fp, FnPos* last, BBCC* bbcc)
     }
 
     if (last->obj != bbcc->cxt->fn[0]->file->obj) {
-	print_obj(fp, "ob=", bbcc->cxt->fn[0]->file->obj);
+	print_obj(fp, CLGB_TAG_OB, bbcc->cxt->fn[0]->file->obj);
 	last->obj = bbcc->cxt->fn[0]->file->obj;
 	res = True;
     }
 
     if (last->file != bbcc->cxt->fn[0]->file) {
-        print_file(fp, "fl=", bbcc->cxt->fn[0]->file);
+        print_file(fp, CLGB_TAG_FL, bbcc->cxt->fn[0]->file);
 	last->file = bbcc->cxt->fn[0]->file;
 	res = True;
     }
 
     if (!CLG_(clo).mangle_names) {
 	if (last->fn != bbcc->cxt->fn[0]) {
-	    print_fn(fp, "fn", bbcc->cxt->fn[0]);
+	    print_fn(fp, CLGB_TAG_FN, bbcc->cxt->fn[0]);
 	    last->fn = bbcc->cxt->fn[0];
 	    res = True;
 	}
@@ -323,7 +539,7 @@ static Bool print_fn_pos(VgFile *fp, FnPos* last, BBCC* bbcc)
 	if ((last->rec_index != bbcc->rec_index) ||
 	    (last->cxt != bbcc->cxt)) {
 
-	    print_mangled_fn(fp, "fn", bbcc->cxt, bbcc->rec_index);
+	    print_mangled_fn(fp, CLGB_TAG_FN, bbcc->cxt, bbcc->rec_index);
 	    last->fn = bbcc->cxt->fn[0];
 	    last->rec_index = bbcc->rec_index;
 	    res = True;
@@ -444,20 +660,35 @@ static void fprint_apos(VgFile *fp, AddrPos* curr, AddrPos* last,
 
 	/* if we switch back to orig file, use fe=... */
 	if (curr->file == func_file)
-            print_file(fp, "fe=", curr->file);
+            print_file(fp, CLGB_TAG_FE, curr->file);
 	else
-            print_file(fp, "fi=", curr->file);
+            print_file(fp, CLGB_TAG_FI, curr->file);
     }
 
     if (CLG_(clo).dump_bbs) {
 	if (curr->line != last->line) {
-	    VG_(fprintf)(fp, "ln=%u\n", curr->line);
+	    dump_printf(fp, "ln=%u\n", curr->line);
 	}
     }
 }
 
 
 
+/**
+ * Write a position in binary format, as differences to <last>.
+ * The caller has to reserve 3 * BIN_MAXNUM bytes.
+ */
+static __inline__
+void bin_pos(const AddrPos* curr, const AddrPos* last)
+{
+    if (CLG_(clo).dump_instr)
+	bin_sleb((Long)(Word)(curr->addr - last->addr));
+    if (CLG_(clo).dump_bb)
+	bin_sleb((Long)(Word)(curr->bb_addr - last->bb_addr));
+    if (CLG_(clo).dump_line)
+	bin_sleb((Int)(curr->line - last->line));
+}
+
 /**
  * Print a position.
  * This prints out differences if allowed
@@ -531,6 +762,24 @@ void fprint_cost(VgFile *fp, const EventMapping* es, const ULong* cost)
   CLG_FREE(mcost);
 }
 
+/**
+ * Write events in binary format, skipping trailing zeros as
+ * CLG_(mappingcost_as_string) does.
+ */
+static
+void bin_cost(const EventMapping* es, const ULong* cost)
+{
+  Int i, n = 1;
+
+  for(i=1; i<es->size; i++)
+    if (cost[es->entry[i].offset] != 0) n = i+1;
+
+  bin_reserve((n+1) * BIN_MAXNUM);
+  bin_uleb(n);
+  for(i=0; i<n; i++)
+    bin_uleb(cost[es->entry[i].offset]);
+}
+
 
 
 /* Write the cost of a source line; only that parts of the source
@@ -546,10 +795,19 @@ static void fprint_fcost(VgFile *fp, AddrCost* c, AddrPos* last)
     CLG_(print_cost)(-5, CLG_(sets).full, c->cost);
   }
     
-  fprint_pos(fp, &(c->p), last);
-  copy_apos( last, &(c->p) ); /* update last to current position */
+  if (CLG_(clo).dump_binary) {
+    bin_reserve(1 + 3 * BIN_MAXNUM);
+    bin_byte(CLGB_COST);
+    bin_pos(&(c->p), last);
+    copy_apos( last, &(c->p) );
+    bin_cost(CLG_(dumpmap), c->cost);
+  }
+  else {
+    fprint_pos(fp, &(c->p), last);
+    copy_apos( last, &(c->p) ); /* update last to current position */
 
-  fprint_cost(fp, CLG_(dumpmap), c->cost);
+    fprint_cost(fp, CLG_(dumpmap), c->cost);
+  }
 
   /* add cost to total */
   CLG_(add_and_zero_cost)( CLG_(sets).full, dump_total_cost, c->cost );
@@ -599,18 +857,32 @@ static void fprint_jcc(VgFile *fp, jCC* jcc, AddrPos* curr, AddrPos* last,
 	 * which change the stack, and thus context
 	 */
 	if (last->file != target.file) {
-            print_file(fp, "jfi=", target.file);
+            print_file(fp, CLGB_TAG_JFI, target.file);
 	}
 	
 	if (jcc->from->cxt != jcc->to->cxt) {
 	    if (CLG_(clo).mangle_names)
-		print_mangled_fn(fp, "jfn",
+		print_mangled_fn(fp, CLGB_TAG_JFN,
 				 jcc->to->cxt, jcc->to->rec_index);
 	    else
-		print_fn(fp, "jfn", jcc->to->cxt->fn[0]);
+		print_fn(fp, CLGB_TAG_JFN, jcc->to->cxt->fn[0]);
 	}
 	    
-	if (jcc->jmpkind == jk_CondJump) {
+	if (CLG_(clo).dump_binary) {
+	    bin_reserve(1 + 8 * BIN_MAXNUM);
+	    if (jcc->jmpkind == jk_CondJump) {
+		bin_byte(CLGB_JCND);
+		bin_uleb(jcc->call_counter);
+		bin_uleb(ecounter);
+	    }
+	    else {
+		bin_byte(CLGB_JUMP);
+		bin_uleb(jcc->call_counter);
+	    }
+	    bin_pos(&target, last);
+	    bin_pos(curr, last);
+	}
+	else if (jcc->jmpkind == jk_CondJump) {
 	    /* format: jcnd=<followed>/<executions> <target> */
 	    VG_(fprintf)(fp, "jcnd=%llu/%llu ",
 			 jcc->call_counter, ecounter);
@@ -620,11 +892,13 @@ static void fprint_jcc(VgFile *fp, jCC* jcc, AddrPos* curr, AddrPos* last,
 	    VG_(fprintf)(fp, "jump=%llu ",
 			 jcc->call_counter);
 	}
-		
-	fprint_pos(fp, &target, last);
-	VG_(fprintf)(fp, "\n");
-	fprint_pos(fp, curr, last);
-	VG_(fprintf)(fp, "\n");
+
+	if (!CLG_(clo).dump_binary) {
+	    fprint_pos(fp, &target, last);
+	    VG_(fprintf)(fp, "\n");
+	    fprint_pos(fp, curr, last);
+	    VG_(fprintf)(fp, "\n");
+	}
 
 	jcc->call_counter = 0;
 	return;
@@ -635,27 +909,37 @@ static void fprint_jcc(VgFile *fp, jCC* jcc, AddrPos* curr, AddrPos* last,
     
     /* object of called position different to object of this function?*/
     if (jcc->from->cxt->fn[0]->file->obj != obj) {
-	print_obj(fp, "cob=", obj);
+	print_obj(fp, CLGB_TAG_COB, obj);
     }
 
     /* file of called position different to current file? */
     if (last->file != file) {
-        print_file(fp, "cfi=", file);
+        print_file(fp, CLGB_TAG_CFI, file);
     }
 
     if (CLG_(clo).mangle_names)
-	print_mangled_fn(fp, "cfn", jcc->to->cxt, jcc->to->rec_index);
+	print_mangled_fn(fp, CLGB_TAG_CFN, jcc->to->cxt, jcc->to->rec_index);
     else
-	print_fn(fp, "cfn", jcc->to->cxt->fn[0]);
+	print_fn(fp, CLGB_TAG_CFN, jcc->to->cxt->fn[0]);
 
     if (!CLG_(is_zero_cost)( CLG_(sets).full, jcc->cost)) {
-        VG_(fprintf)(fp, "calls=%llu ", 
-		   jcc->call_counter);
+	if (CLG_(clo).dump_binary) {
+	    bin_reserve(1 + 7 * BIN_MAXNUM);
+	    bin_byte(CLGB_CALLS);
+	    bin_uleb(jcc->call_counter);
+	    bin_pos(&target, last);
+	    bin_pos(curr, last);
+	    bin_cost(CLG_(dumpmap), jcc->cost);
+	}
+	else {
+	    VG_(fprintf)(fp, "calls=%llu ",
+			 jcc->call_counter);
 
-	fprint_pos(fp, &target, last);
-        VG_(fprintf)(fp, "\n");
-	fprint_pos(fp, curr, last);
-	fprint_cost(fp, CLG_(dumpmap), jcc->cost);
+	    fprint_pos(fp, &target, last);
+	    VG_(fprintf)(fp, "\n");
+	    fprint_pos(fp, curr, last);
+	    fprint_cost(fp, CLG_(dumpmap), jcc->cost);
+	}
 
 	CLG_(init_cost)( CLG_(sets).full, jcc->cost );
 
@@ -815,7 +1099,7 @@ static Bool fprint_bbcc(VgFile *fp, BBCC* bbcc, AddrPos* last)
       fprint_apos(fp, &(currCost->p), last, bbcc->cxt->fn[0]->file);
       fprint_fcost(fp, currCost, last);
     }
-    if (CLG_(clo).dump_bbs) VG_(fprintf)(fp, "\n");
+    if (CLG_(clo).dump_bbs) dump_printf(fp, "\n");
     
     /* when every cost was immediately written, we must have done so,
      * as this function is only called when there's cost in a BBCC
@@ -1216,7 +1500,10 @@ static VgFile *new_dumpfile(int tid, const HChar* trigger)
 
     if (!appending) {
 	/* callgrind format specification, has to be on 1st line */
-	VG_(fprintf)(fp, "# callgrind format\n");
+	if (CLG_(clo).dump_binary)
+	    VG_(fprintf)(fp, CLGB_MAGIC);
+	else
+	    VG_(fprintf)(fp, "# callgrind format\n");
 
 	/* version */
 	VG_(fprintf)(fp, "version: 1\n");
@@ -1336,6 +1623,9 @@ static VgFile *new_dumpfile(int tid, const HChar* trigger)
 
    VG_(fprintf)(fp, "\n\n");
 
+   if (CLG_(clo).dump_binary)
+       bin_start(fp);
+
    if (VG_(clo_verbosity) > 1)
        VG_(message)(Vg_DebugMsg, "Dump to %s\n", filename);
 
@@ -1347,6 +1637,9 @@ static void close_dumpfile(VgFile *fp)
 {
     if (fp == NULL) return;
 
+    if (CLG_(clo).dump_binary)
+	bin_end();
+
     fprint_cost_ln(fp, "totals: ", CLG_(dumpmap),
 		   dump_total_cost);
     //fprint_fcc_ln(fp, "summary: ", &dump_total_fcc);
@@ -1402,9 +1695,9 @@ static void print_bbccs_of_thread(thread_info* ti)
       
       if (ccSum[currSum].p.file != lastFnPos.cxt->fn[0]->file) {
 	/* switch back to file of function */
-	print_file(print_fp, "fe=", lastFnPos.cxt->fn[0]->file);
+	print_file(print_fp, CLGB_TAG_FE, lastFnPos.cxt->fn[0]->file);
       }
-      VG_(fprintf)(print_fp, "\n");
+      dump_printf(print_fp, "\n");
     }
     
     if (*p == 0) break;
@@ -1413,6 +1706,10 @@ static void print_bbccs_of_thread(thread_info* ti)
       
       /* new function */
       init_apos(&lastAPos, 0, 0, (*p)->cxt->fn[0]->file);
+      if (CLG_(clo).dump_binary) {
+	bin_reserve(1);
+	bin_byte(CLGB_NEWFN);
+      }
       init_fcost(&ccSum[0], 0, 0, 0);
       init_fcost(&ccSum[1], 0, 0, 0);
       currSum = 0;
@@ -1422,14 +1719,14 @@ static void print_bbccs_of_thread(thread_info* ti)
 	/* FIXME: Specify Object of BB if different to object of fn */
         int i;
 	ULong ecounter = (*p)->ecounter_sum;
-        VG_(fprintf)(print_fp, "bb=%#lx ", (UWord)(*p)->bb->offset);
+        dump_printf(print_fp, "bb=%#lx ", (UWord)(*p)->bb->offset);
 	for(i = 0; i<(*p)->bb->cjmp_count;i++) {
-	    VG_(fprintf)(print_fp, "%u %llu ", 
+	    dump_printf(print_fp, "%u %llu ",
 				(*p)->bb->jmp[i].instr,
 				ecounter);
 	    ecounter -= (*p)->jmp[i].ecounter;
 	}
-	VG_(fprintf)(print_fp, "%u %llu\n", 
+	dump_printf(print_fp, "%u %llu\n",
 		     (*p)->bb->instr_count,
 		     ecounter);
     }
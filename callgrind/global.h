@@ -87,6 +87,7 @@ struct _CommandLineOptions {
   Bool dump_instr;
   Bool dump_bb;
   Bool dump_bbs;         /* Dump basic block information? */
+  Bool dump_binary;      /* Write cost lines in binary format? */
   
   /* Dump generation options */
   ULong dump_every_bb;     /* Dump every xxx BBs. */
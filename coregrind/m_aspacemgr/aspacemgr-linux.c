@@ -672,7 +672,8 @@ static Bool maybe_merge_nsegments ( NSegment* s1, const NSegment* s2 )
 
       case SkAnonC: case SkAnonV:
          if (s1->hasR == s2->hasR && s1->hasW == s2->hasW 
-             && s1->hasX == s2->hasX && s1->isCH == s2->isCH) {
+             && s1->hasX == s2->hasX && s1->isCH == s2->isCH
+             && s1->isShared == s2->isShared) {
             s1->end = s2->end;
             s1->hasT |= s2->hasT;
             return True;
@@ -682,6 +683,7 @@ static Bool maybe_merge_nsegments ( NSegment* s1, const NSegment* s2 )
       case SkFileC: case SkFileV:
          if (s1->hasR == s2->hasR 
              && s1->hasW == s2->hasW && s1->hasX == s2->hasX
+             && s1->isShared == s2->isShared
              && s1->dev == s2->dev && s1->ino == s2->ino
              && s2->offset == s1->offset
                               + ((ULong)s2->start) - ((ULong)s1->start) ) {
@@ -1493,6 +1495,7 @@ static void init_nsegment ( /*OUT*/NSegment* seg )
    seg->offset   = 0;
    seg->fnIdx    = -1;
    seg->hasR = seg->hasW = seg->hasX = seg->hasT = seg->isCH = False;
+   seg->isShared = False;
 }
 
 /* Make an NSegment which holds a reservation. */
@@ -2172,6 +2175,7 @@ VG_(am_notify_client_mmap)( Addr a, SizeT len, UInt prot, UInt flags,
    seg.hasR   = toBool(prot & VKI_PROT_READ);
    seg.hasW   = toBool(prot & VKI_PROT_WRITE);
    seg.hasX   = toBool(prot & VKI_PROT_EXEC);
+   seg.isShared = toBool(flags & VKI_MAP_SHARED);
    if (!(flags & VKI_MAP_ANONYMOUS)) {
       // Nb: We ignore offset requests in anonymous mmaps (see bug #126722)
       seg.offset = offset;
@@ -2411,6 +2415,7 @@ SysRes VG_(am_mmap_named_file_fixed_client_flags)
    seg.start  = start;
    seg.end    = seg.start + VG_PGROUNDUP(length) - 1;
    seg.offset = offset;
+   seg.isShared = toBool(flags & VKI_MAP_SHARED);
    seg.hasR   = toBool(prot & VKI_PROT_READ);
    seg.hasW   = toBool(prot & VKI_PROT_WRITE);
    seg.hasX   = toBool(prot & VKI_PROT_EXEC);
@@ -2657,6 +2662,27 @@ void* VG_(am_shadow_alloc)(SizeT size)
    return sr_isError(sres) ? NULL : (void*)sr_Res(sres);
 }
 
+/* Ask the kernel to back the given range, which must be memory of
+   valgrind's own, with transparent huge pages.  This is only a hint.
+   Returns False if the kernel rejected it, for example because it
+   doesn't support transparent huge pages. */
+
+Bool VG_(am_advise_hugepages) ( Addr start, SizeT length )
+{
+#  if defined(VKI_MADV_HUGEPAGE)
+   SysRes sres;
+   NSegment const* first = VG_(am_find_nsegment)( start );
+   NSegment const* last  = VG_(am_find_nsegment)( start + length - 1 );
+   aspacem_assert(VG_IS_PAGE_ALIGNED(start) && VG_IS_PAGE_ALIGNED(length));
+   aspacem_assert(first && (first->kind == SkAnonV || first->kind == SkFileV));
+   aspacem_assert(last && (last->kind == SkAnonV || last->kind == SkFileV));
+   sres = VG_(do_syscall3)( __NR_madvise, start, length, VKI_MADV_HUGEPAGE );
+   return !sr_isError(sres);
+#  else
+   return False;
+#  endif
+}
+
 /* Map a file at an unconstrained address for V, and update the
    segment array accordingly. Use the provided flags */
 
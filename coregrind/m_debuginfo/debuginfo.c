@@ -1915,6 +1915,21 @@ Bool VG_(get_fnname_if_entry) ( Addr a, const HChar** buf )
    return res;
 }
 
+/* This is available to tools... gives the extent of the text symbol
+   containing 'a'. */
+Bool VG_(get_fn_extent) ( Addr a, /*OUT*/Addr* start, /*OUT*/SizeT* size )
+{
+   DebugInfo* di;
+   Word       sno;
+
+   search_all_symtabs ( a, &di, &sno, True/*consider text symbols only*/ );
+   if (di == NULL)
+      return False;
+   *start = di->symtab[sno].avmas.main;
+   *size  = di->symtab[sno].size;
+   return True;
+}
+
 /* This is only available to core... don't C++-demangle, don't Z-demangle,
    don't rename below-main, match anywhere in function, and don't show
    offsets.
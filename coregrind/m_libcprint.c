@@ -861,6 +861,28 @@ UInt VG_(fprintf) ( VgFile *fp, const HChar *format, ... )
    return ret;
 }
 
+void VG_(fwrite)( VgFile *fp, const void *buf, SizeT nbytes )
+{
+   const HChar *p = buf;
+
+   if (fp->num_chars + nbytes <= VGFILE_BUFSIZE) {
+      VG_(memcpy)(fp->buf + fp->num_chars, p, nbytes);
+      fp->num_chars += nbytes;
+      return;
+   }
+
+   // Too big for the buffer: flush it and write the bytes directly.
+   if (fp->num_chars)
+      VG_(write)(fp->fd, fp->buf, fp->num_chars);
+   fp->num_chars = 0;
+   while (nbytes > 0) {
+      Int n = VG_(write)(fp->fd, p, nbytes);
+      if (n <= 0) break;
+      p += n;
+      nbytes -= n;
+   }
+}
+
 void VG_(fclose)( VgFile *fp )
 {
    // Flush the buffer.
@@ -65,6 +65,7 @@
 #include "pub_core_translate.h"     // For VG_(translate)
 #include "pub_core_trampoline.h"
 #include "pub_core_transtab.h"
+#include "pub_core_transcache.h"
 #include "pub_core_inner.h"
 #if defined(ENABLE_INNER_CLIENT_REQUEST)
 #include "pub_core_clreq.h"
@@ -200,6 +201,10 @@ static void usage_NORETURN ( Bool debug_help )
 "           more sectors may increase performance, but use more memory.\n"
 "    --avg-transtab-entry-size=<number> avg size in bytes of a translated\n"
 "           basic block [0, meaning use tool provided default]\n"
+"    --translation-cache=<file> save translations in <file> and reuse\n"
+"           them in later runs of the same tool with the same options [none]\n"
+"    --hot-traces=<number>     retranslate superblocks run <number> times\n"
+"           as traces across conditional branches [0, meaning never]\n"
 "    --aspace-minaddr=0xPP     avoid mapping memory below 0xPP [guessed]\n"
 "    --valgrind-stacksize=<number> size of valgrind (host) thread's stack\n"
 "                               (in bytes) ["
@@ -677,6 +682,10 @@ void main_process_cmd_line_options( void )
       else if VG_BINT_CLO(arg, "--avg-transtab-entry-size",
                                VG_(clo_avg_transtab_entry_size),
                                50, 5000) {}
+      else if VG_STR_CLO (arg, "--translation-cache",
+                               VG_(clo_translation_cache)) {}
+      else if VG_BINT_CLO(arg, "--hot-traces",
+                               VG_(clo_hot_traces), 0, 1000000000) {}
       else if VG_BINT_CLO(arg, "--merge-recursive-frames",
                                VG_(clo_merge_recursive_frames), 0,
                                VG_DEEPEST_BACKTRACE) {}
@@ -1657,6 +1666,7 @@ Int valgrind_main ( Int argc, HChar **argv, HChar **envp )
    //--------------------------------------------------------------
    VG_(debugLog)(1, "main", "Initialise TT/TC\n");
    VG_(init_tt_tc)();
+   VG_(init_transcache)();
 
    //--------------------------------------------------------------
    // Initialise the redirect table.
@@ -2147,6 +2157,9 @@ void shutdown_actions_NORETURN( ThreadId tid,
 
    VG_(sanity_check_general)( True /*include expensive checks*/ );
 
+   /* Save this run's translations for the next one, if requested. */
+   VG_(transcache_shutdown)();
+
    if (VG_(clo_stats))
       VG_(print_all_stats)(VG_(clo_verbosity) >= 1, /* Memory stats */
                            False /* tool prints stats in the tool fini */);
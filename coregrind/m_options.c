@@ -140,6 +140,8 @@ Bool   VG_(clo_dsymutil)       = True;
 Bool   VG_(clo_sigill_diag)    = True;
 UInt   VG_(clo_unw_stack_scan_thresh) = 0; /* disabled by default */
 UInt   VG_(clo_unw_stack_scan_frames) = 5;
+const HChar* VG_(clo_translation_cache) = NULL;
+UInt   VG_(clo_hot_traces)     = 0;
 
 // Set clo_smc_check so that it provides transparent self modifying
 // code support for "correct" programs at the smallest achievable
@@ -41,6 +41,7 @@ struct sched_lock_ops {
    int (*get_sched_lock_owner)(struct sched_lock *p);
    void (*acquire_sched_lock)(struct sched_lock *p);
    void (*release_sched_lock)(struct sched_lock *p);
+   Bool (*sched_lock_has_waiters)(struct sched_lock *p);
 };
 
 extern const struct sched_lock_ops ML_(generic_sched_lock_ops);
@@ -31,6 +31,7 @@
    The GNU General Public License is contained in the file COPYING.
 */
 
+#include "config.h"
 #include "pub_core_basics.h"
 #include "pub_core_mallocfree.h"
 #include "priv_sema.h"
@@ -39,6 +40,9 @@
 
 struct sched_lock {
    vg_sema_t sema;
+   /* Number of threads in acquire_sched_lock, including the one which
+      is about to get the lock. */
+   volatile Int n_acquiring;
 };
 
 static const HChar *get_sched_lock_name(void)
@@ -52,6 +56,7 @@ static struct sched_lock *create_sched_lock(void)
 
    p = VG_(malloc)("sched_lock", sizeof(*p));
    ML_(sema_init)(&p->sema);
+   p->n_acquiring = 0;
    return p;
 }
 
@@ -68,7 +73,13 @@ static int get_sched_lock_owner(struct sched_lock *p)
 
 static void acquire_sched_lock(struct sched_lock *p)
 {
+#if defined(HAVE_BUILTIN_ATOMIC)
+   __sync_fetch_and_add(&p->n_acquiring, 1);
+#endif
    ML_(sema_down)(&p->sema, False);
+#if defined(HAVE_BUILTIN_ATOMIC)
+   __sync_fetch_and_sub(&p->n_acquiring, 1);
+#endif
 }
 
 static void release_sched_lock(struct sched_lock *p)
@@ -76,6 +87,17 @@ static void release_sched_lock(struct sched_lock *p)
    ML_(sema_up)(&p->sema, False);
 }
 
+static Bool sched_lock_has_waiters(struct sched_lock *p)
+{
+#if defined(HAVE_BUILTIN_ATOMIC)
+   return p->n_acquiring > 0;
+#else
+   /* Without atomics we cannot count the waiters, so always assume
+      that there are some. */
+   return True;
+#endif
+}
+
 const struct sched_lock_ops ML_(generic_sched_lock_ops) = {
    .get_sched_lock_name  = get_sched_lock_name,
    .create_sched_lock    = create_sched_lock,
@@ -83,4 +105,5 @@ const struct sched_lock_ops ML_(generic_sched_lock_ops) = {
    .get_sched_lock_owner = get_sched_lock_owner,
    .acquire_sched_lock   = acquire_sched_lock,
    .release_sched_lock   = release_sched_lock,
+   .sched_lock_has_waiters = sched_lock_has_waiters,
 };
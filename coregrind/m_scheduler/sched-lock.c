@@ -94,3 +94,13 @@ void ML_(release_sched_lock)(struct sched_lock *p)
 {
    return (sched_lock_ops->release_sched_lock)(p);
 }
+
+/**
+ * Whether any thread other than the owner is blocked in
+ * ML_(acquire_sched_lock)(). The answer is only a hint: a thread may
+ * start waiting just after this function returned False.
+ */
+Bool ML_(sched_lock_has_waiters)(struct sched_lock *p)
+{
+   return (sched_lock_ops->sched_lock_has_waiters)(p);
+}
@@ -129,6 +129,9 @@ static void mostly_clear_thread_record ( ThreadId tid );
 /* Stats. */
 static ULong n_scheduling_events_MINOR = 0;
 static ULong n_scheduling_events_MAJOR = 0;
+/* Number of MAJOR events at which the_BigLock was kept, because no
+   other thread was waiting for it. */
+static ULong n_scheduling_events_MAJOR_kept = 0;
 
 /* Stats: number of XIndirs, and number that missed in the fast
    cache. */
@@ -157,6 +160,9 @@ void VG_(print_scheduler_stats)(void)
    VG_(message)(Vg_DebugMsg,
       "scheduler: %'llu/%'llu major/minor sched events.\n",
       n_scheduling_events_MAJOR, n_scheduling_events_MINOR);
+   VG_(message)(Vg_DebugMsg,
+      "scheduler: %'llu major sched events without lock handoff.\n",
+      n_scheduling_events_MAJOR_kept);
    VG_(message)(Vg_DebugMsg, 
                 "   sanity: %u cheap, %u expensive checks.\n",
                 sanity_fast_count, sanity_slow_count );
@@ -946,8 +952,11 @@ void run_thread_for_a_while ( /*OUT*/HWord* two_words,
 
    /* Set up return-value area. */
 
-   // Tell the tool this thread is about to run client code
+   // Tell the tool this thread is about to run client code.  No
+   // translation is running, so the tool may discard some.
+   VG_(ok_to_discard_translations) = True;
    VG_TRACK( start_client_code, tid, bbs_done );
+   VG_(ok_to_discard_translations) = False;
 
    vg_assert(VG_(in_generated_code) == False);
    VG_(in_generated_code) = True;
@@ -1304,12 +1313,22 @@ VgSchedReturnCode VG_(scheduler) ( ThreadId tid )
 	 /* 3 Aug 06: doing sys__nsleep works but crashes some apps.
             sys_yield also helps the problem, whilst not crashing apps. */
 
-	 VG_(release_BigLock)(tid, VgTs_Yielding, 
-                                   "VG_(scheduler):timeslice");
-	 /* ------------ now we don't have The Lock ------------ */
-
-	 VG_(acquire_BigLock)(tid, "VG_(scheduler):timeslice");
-	 /* ------------ now we do have The Lock ------------ */
+         /* If no other thread is waiting for the lock, handing it over
+            only costs a couple of syscalls (a pipe write and read with
+            the generic lock) and we would get it straight back.  So
+            just keep it and carry on with the housekeeping below.  A
+            thread which starts waiting just after this check gets the
+            lock at the end of our next timeslice. */
+         if (ML_(sched_lock_has_waiters)(the_BigLock)) {
+            VG_(release_BigLock)(tid, VgTs_Yielding,
+                                      "VG_(scheduler):timeslice");
+            /* ------------ now we don't have The Lock ------------ */
+
+            VG_(acquire_BigLock)(tid, "VG_(scheduler):timeslice");
+            /* ------------ now we do have The Lock ------------ */
+         } else {
+            n_scheduling_events_MAJOR_kept++;
+         }
 
 	 /* OK, do some relatively expensive housekeeping stuff */
 	 scheduler_sanity(tid);
@@ -1325,6 +1344,15 @@ VgSchedReturnCode VG_(scheduler) ( ThreadId tid )
 	 /* For stats purposes only. */
 	 n_scheduling_events_MAJOR++;
 
+         /* Code that runs entirely from chained translations and the
+            fast cache never reaches VG_(search_transtab), so sample
+            where this thread is now, so that the sector holding the
+            code is less likely to be the next one recycled. */
+         VG_(sample_transtab_use)( VG_(get_IP)(tid) );
+
+         if (VG_(clo_hot_traces) > 0)
+            VG_(promote_hot_translations)();
+
 	 /* Figure out how many bbs to ask vg_run_innerloop to do. */
          dispatch_ctr = SCHEDULING_QUANTUM;
 
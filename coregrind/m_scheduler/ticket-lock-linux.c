@@ -183,6 +183,15 @@ static void release_sched_lock(struct sched_lock *p)
    }
 }
 
+/*
+ * The owner holds ticket 'head', so any ticket between head + 1 and tail - 1
+ * belongs to a thread waiting in acquire_sched_lock().
+ */
+static Bool sched_lock_has_waiters(struct sched_lock *p)
+{
+   return p->tail - p->head > 1;
+}
+
 const struct sched_lock_ops ML_(linux_ticket_lock_ops) = {
    .get_sched_lock_name  = get_sched_lock_name,
    .create_sched_lock    = create_sched_lock,
@@ -190,4 +199,5 @@ const struct sched_lock_ops ML_(linux_ticket_lock_ops) = {
    .get_sched_lock_owner = get_sched_lock_owner,
    .acquire_sched_lock   = acquire_sched_lock,
    .release_sched_lock   = release_sched_lock,
+   .sched_lock_has_waiters = sched_lock_has_waiters,
 };
@@ -0,0 +1,614 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Persistent, on-disk cache of translations.                   ---*/
+/*---                                                m_transcache.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Valgrind, a dynamic binary instrumentation
+   framework.
+
+   Copyright (C) 2000-2017 Julian Seward
+      jseward@acm.org
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_core_basics.h"
+#include "pub_core_vki.h"
+#include "pub_core_aspacemgr.h"  // VG_(am_find_nsegment)
+#include "pub_core_clientstate.h"// VG_(args_for_valgrind)
+#include "pub_core_gdbserver.h"  // VG_(gdbserver_instrumentation_needed)
+#include "pub_core_hashtable.h"
+#include "pub_core_libcbase.h"
+#include "pub_core_libcassert.h"
+#include "pub_core_libcfile.h"
+#include "pub_core_libcprint.h"
+#include "pub_core_libcproc.h"   // VG_(getpid), VG_(libdir)
+#include "pub_core_machine.h"    // VG_(machine_get_VexArchInfo)
+#include "pub_core_mallocfree.h"
+#include "pub_core_options.h"
+#include "pub_core_tooliface.h"  // VG_(needs)
+#include "pub_core_xarray.h"
+#include "pub_core_transcache.h" // self
+
+
+/* How it works
+   ~~~~~~~~~~~~
+   Host code produced by LibVEX_Translate, before it is copied into
+   the translation cache, is position independent: it refers to the
+   dispatcher, the guest state and the tool's helper functions by
+   absolute address, but not to its own location.  The tool executable
+   is statically linked at a fixed address, so as long as the same
+   tool binary is used, with the same options, on the same host CPU,
+   the code made for a given piece of guest code is the same from one
+   run to the next -- with the exception of translations which embed
+   run-specific values (ExeContext unique numbers, gdbserver
+   instrumentation) which the caller must not hand to us.  Unchained
+   jumps go to VG_(disp_cp_chain_me_to_{slow,fast}EP), and the profile
+   counter, if any, is patched by VG_(add_to_transtab), so a cached
+   translation can simply be put into the TC in place of a new one.
+
+   The file starts with a header holding a hash of everything that
+   determines the generated code (the tool executable's identity, the
+   command line, the host architecture and its capabilities).  If the
+   hash does not match, the file is ignored and rewritten at exit.
+   Then follows a sequence of records, each holding the guest extents,
+   a copy of the guest bytes, and the host code.
+
+   A record is only used if the guest bytes are still identical to
+   what is in memory now, every extent is still in a read-only
+   file-backed mapping, the redirection kind of the entry point is
+   unchanged, and VEX would still be allowed to chase into each of the
+   secondary extents.  Comparing the bytes subsumes any check of the
+   object's build-id, and also catches objects mapped at a different
+   address, or replaced on disk.
+
+   Only code from file-backed mappings is cached, since code in
+   anonymous memory is typically generated at run time and needs a
+   self-check anyway, and --smc-check=all/stack disable the cache.
+*/
+
+/* Nr of translations found in/added to the cache, for stats. */
+static ULong n_tc_lookups  = 0;
+static ULong n_tc_hits     = 0;
+static ULong n_tc_stale    = 0;
+static ULong n_tc_loaded   = 0;
+static ULong n_tc_added    = 0;
+static ULong n_tc_unsuited = 0;
+
+/* The file may not grow beyond this size.  Translations made after
+   that are simply not recorded. */
+#define TC_MAX_FILE_SZB (512ULL * 1024ULL * 1024ULL)
+
+#define TC_MAGIC "VGTCACH1"
+
+typedef
+   struct {
+      HChar magic[8];
+      ULong key;
+   }
+   TCFileHeader;
+
+/* A record is a TCRecord, followed by the guest bytes of all extents,
+   followed by the host code, padded to a multiple of 8 bytes. */
+typedef
+   struct {
+      UInt   rec_szB;      /* total size, including this header */
+      UInt   checksum;     /* of the record, with this field zero */
+      Addr   nraddr;
+      Addr   addr;
+      Addr   vge_base[3];
+      UShort vge_len[3];
+      UChar  vge_n_used;
+      UChar  kind;
+      Int    offs_profInc;
+      UInt   n_guest_instrs;
+      UInt   code_len;
+   }
+   TCRecord;
+
+/* Index of the records read from the file, keyed by nraddr.  Records
+   with the same nraddr are chained via .dup. */
+typedef
+   struct _TCNode {
+      struct _TCNode* next;
+      UWord           key;
+      struct _TCNode* dup;
+      const TCRecord* rec;
+   }
+   TCNode;
+
+static Bool         tc_enabled   = False;
+static HChar*       tc_filename  = NULL;
+static ULong        tc_key       = 0;
+static Int          tc_owner_pid = 0;
+
+/* The valid part of the file contents, as read at startup (not
+   including the header), and whether the file as a whole is in good
+   shape, so new records can just be appended to it. */
+static UChar*       tc_loaded      = NULL;
+static SizeT        tc_loaded_szB  = 0;
+static Bool         tc_file_clean  = False;
+static VgHashTable* tc_index       = NULL;
+
+/* Records made in this run, to be written out at exit. */
+static XArray*      tc_new_recs    = NULL; /* of UChar */
+
+
+/*------------------------------------------------------------*/
+/*--- Hashing                                              ---*/
+/*------------------------------------------------------------*/
+
+static inline ULong fnv64 ( ULong h, const void* p, SizeT n )
+{
+   const UChar* b = p;
+   SizeT i;
+   for (i = 0; i < n; i++) {
+      h ^= b[i];
+      h *= 0x100000001b3ULL;
+   }
+   return h;
+}
+
+#define FNV64_INIT 0xcbf29ce484222325ULL
+
+static UInt record_checksum ( const TCRecord* rec )
+{
+   TCRecord hdr = *rec;
+   ULong    h;
+   hdr.checksum = 0;
+   h = fnv64(FNV64_INIT, &hdr, sizeof(hdr));
+   h = fnv64(h, (const UChar*)rec + sizeof(TCRecord),
+             rec->rec_szB - sizeof(TCRecord));
+   return (UInt)(h ^ (h >> 32));
+}
+
+/* Compute a hash of everything, other than the guest code itself,
+   which might affect the generated code. */
+static ULong compute_key ( void )
+{
+   ULong       h = FNV64_INIT;
+   VexArch     arch;
+   VexArchInfo archinfo;
+   Int         i;
+
+   h = fnv64(h, TC_MAGIC, sizeof(TC_MAGIC));
+   h = fnv64(h, VG_(clo_toolname), VG_(strlen)(VG_(clo_toolname)));
+
+   /* The tool executable.  If it is rebuilt, the addresses of the
+      helper functions referred to by the generated code may change. */
+   { const HChar* platform = VG_PLATFORM;
+     HChar exe[VG_(strlen)(VG_(libdir)) + 1 + VG_(strlen)(VG_(clo_toolname))
+               + 1 + VG_(strlen)(platform) + 1];
+     struct vg_stat st;
+     VG_(sprintf)(exe, "%s/%s-%s", VG_(libdir), VG_(clo_toolname), platform);
+     VG_(memset)(&st, 0, sizeof(st));
+     if (!sr_isError(VG_(stat)(exe, &st))) {
+        h = fnv64(h, &st.ino,   sizeof(st.ino));
+        h = fnv64(h, &st.size,  sizeof(st.size));
+        h = fnv64(h, &st.mtime, sizeof(st.mtime));
+        h = fnv64(h, &st.mtime_nsec, sizeof(st.mtime_nsec));
+     }
+   }
+
+   VG_(machine_get_VexArchInfo)( &arch, &archinfo );
+   h = fnv64(h, &arch, sizeof(arch));
+   h = fnv64(h, &archinfo.hwcaps, sizeof(archinfo.hwcaps));
+   h = fnv64(h, &archinfo.endness, sizeof(archinfo.endness));
+
+   for (i = 0; i < VG_(sizeXA)(VG_(args_for_valgrind)); i++) {
+      const HChar* arg = *(HChar**)VG_(indexXA)(VG_(args_for_valgrind), i);
+      h = fnv64(h, arg, VG_(strlen)(arg) + 1);
+   }
+   return h;
+}
+
+
+/*------------------------------------------------------------*/
+/*--- Reading and writing the file                         ---*/
+/*------------------------------------------------------------*/
+
+static Bool write_all ( Int fd, const void* buf, SizeT n )
+{
+   const UChar* p = buf;
+   while (n > 0) {
+      Int chunk = n > 0x10000000 ? 0x10000000 : (Int)n;
+      Int w = VG_(write)(fd, p, chunk);
+      if (w <= 0)
+         return False;
+      p += w;
+      n -= w;
+   }
+   return True;
+}
+
+static Bool read_all ( Int fd, void* buf, SizeT n )
+{
+   UChar* p = buf;
+   while (n > 0) {
+      Int chunk = n > 0x10000000 ? 0x10000000 : (Int)n;
+      Int r = VG_(read)(fd, p, chunk);
+      if (r <= 0)
+         return False;
+      p += r;
+      n -= r;
+   }
+   return True;
+}
+
+static SizeT guest_bytes_szB ( const TCRecord* rec )
+{
+   SizeT n = 0;
+   UInt  i;
+   for (i = 0; i < rec->vge_n_used; i++)
+      n += rec->vge_len[i];
+   return n;
+}
+
+static Bool record_is_sane ( const TCRecord* rec, SizeT avail )
+{
+   if (avail < sizeof(TCRecord))
+      return False;
+   if (rec->rec_szB < sizeof(TCRecord) || rec->rec_szB > avail
+       || (rec->rec_szB & 7) != 0)
+      return False;
+   if (rec->vge_n_used < 1 || rec->vge_n_used > 3)
+      return False;
+   if (rec->code_len == 0 || rec->code_len >= 65536)
+      return False;
+   if (sizeof(TCRecord) + guest_bytes_szB(rec) + rec->code_len
+       > rec->rec_szB)
+      return False;
+   return record_checksum(rec) == rec->checksum;
+}
+
+static void index_record ( const TCRecord* rec )
+{
+   TCNode* node = VG_(HT_lookup)(tc_index, rec->nraddr);
+   TCNode* new  = VG_(malloc)("transcache.index_record", sizeof(TCNode));
+   new->key = rec->nraddr;
+   new->rec = rec;
+   new->dup = NULL;
+   if (node) {
+      /* Most recently written records are the most likely to be
+         valid, so they go at the front. */
+      new->dup  = node->dup;
+      node->dup = new;
+      new->rec  = node->rec;
+      node->rec = rec;
+   } else {
+      VG_(HT_add_node)(tc_index, new);
+   }
+}
+
+static void load_file ( void )
+{
+   TCFileHeader hdr;
+   SysRes       sres;
+   Int          fd;
+   Long         szB;
+   SizeT        off;
+
+   tc_file_clean = False;
+
+   sres = VG_(open)(tc_filename, VKI_O_RDONLY, 0);
+   if (sr_isError(sres))
+      return;
+   fd = sr_Res(sres);
+
+   szB = VG_(fsize)(fd);
+   if (szB < (Long)sizeof(hdr) || !read_all(fd, &hdr, sizeof(hdr))
+       || VG_(memcmp)(hdr.magic, TC_MAGIC, sizeof(hdr.magic)) != 0
+       || hdr.key != tc_key) {
+      if (VG_(clo_verbosity) > 1)
+         VG_(message)(Vg_DebugMsg,
+                      "translation cache %s does not match this run;"
+                      " it will be rewritten\n", tc_filename);
+      VG_(close)(fd);
+      return;
+   }
+
+   szB -= sizeof(hdr);
+   if (szB > 0) {
+      tc_loaded = VG_(malloc)("transcache.load_file", szB);
+      if (!read_all(fd, tc_loaded, szB)) {
+         VG_(free)(tc_loaded);
+         tc_loaded = NULL;
+         VG_(close)(fd);
+         return;
+      }
+   }
+   VG_(close)(fd);
+
+   /* Index all records, stopping at the first bad one.  A bad record
+      is normally a write which was interrupted by a crash; anything
+      after it is unreachable, so the file will be rewritten. */
+   tc_file_clean = True;
+   off = 0;
+   while (off < (SizeT)szB) {
+      const TCRecord* rec = (const TCRecord*)(tc_loaded + off);
+      if (!record_is_sane(rec, szB - off)) {
+         tc_file_clean = False;
+         break;
+      }
+      index_record(rec);
+      n_tc_loaded++;
+      off += rec->rec_szB;
+   }
+   tc_loaded_szB = off;
+
+   if (VG_(clo_verbosity) > 1)
+      VG_(message)(Vg_DebugMsg,
+                   "translation cache %s: %'llu translations loaded\n",
+                   tc_filename, n_tc_loaded);
+}
+
+void VG_(transcache_shutdown) ( void )
+{
+   Int    fd;
+   SysRes sres;
+   SizeT  new_szB;
+
+   if (!tc_enabled)
+      return;
+   /* A forked child shares the parent's view of the file, so leave it
+      to the parent to update it. */
+   if (VG_(getpid)() != tc_owner_pid)
+      return;
+
+   new_szB = VG_(sizeXA)(tc_new_recs);
+   if (new_szB == 0 && tc_file_clean)
+      return;
+
+   if (tc_file_clean) {
+      sres = VG_(open)(tc_filename, VKI_O_WRONLY|VKI_O_APPEND, 0);
+   } else {
+      sres = VG_(open)(tc_filename, VKI_O_WRONLY|VKI_O_CREAT|VKI_O_TRUNC,
+                       VKI_S_IRUSR|VKI_S_IWUSR);
+   }
+   if (sr_isError(sres)) {
+      VG_(umsg)("Warning: cannot write translation cache %s\n", tc_filename);
+      return;
+   }
+   fd = sr_Res(sres);
+
+   Bool ok = True;
+   if (!tc_file_clean) {
+      TCFileHeader hdr;
+      VG_(memcpy)(hdr.magic, TC_MAGIC, sizeof(hdr.magic));
+      hdr.key = tc_key;
+      ok = write_all(fd, &hdr, sizeof(hdr))
+           && write_all(fd, tc_loaded, tc_loaded_szB);
+   }
+   if (ok && new_szB > 0)
+      ok = write_all(fd, VG_(indexXA)(tc_new_recs, 0), new_szB);
+   if (!ok)
+      VG_(umsg)("Warning: error writing translation cache %s\n",
+                tc_filename);
+   VG_(close)(fd);
+}
+
+
+/*------------------------------------------------------------*/
+/*--- Lookup and insertion                                 ---*/
+/*------------------------------------------------------------*/
+
+/* Is [base, +len) in a read-only, file-backed mapping? */
+static Bool extent_is_file_backed ( Addr base, UShort len )
+{
+   NSegment const* seg = VG_(am_find_nsegment)(base);
+   return seg != NULL
+          && seg->kind == SkFileC && seg->hasR && !seg->hasW
+          && (len == 0 || base + len - 1 <= seg->end);
+}
+
+static void TCRecord__to_vge ( /*OUT*/VexGuestExtents* vge,
+                               const TCRecord* rec )
+{
+   UInt i;
+   vge->n_used = rec->vge_n_used;
+   for (i = 0; i < 3; i++) {
+      vge->base[i] = rec->vge_base[i];
+      vge->len[i]  = rec->vge_len[i];
+   }
+}
+
+Bool VG_(search_transcache) ( /*OUT*/VexGuestExtents* vge,
+                              /*OUT*/UChar* host_bytes,
+                              Int           host_bytes_size,
+                              /*OUT*/Int*   host_bytes_used,
+                              /*OUT*/Int*   offs_profInc,
+                              /*OUT*/UInt*  n_guest_instrs,
+                              Addr          nraddr,
+                              Addr          addr,
+                              UInt          kind,
+                              Bool (*chase_into_ok)(void*,Addr),
+                              void*         chase_closure )
+{
+   const TCNode* node;
+   UInt          i;
+
+   if (!tc_enabled || tc_index == NULL)
+      return False;
+
+   n_tc_lookups++;
+   for (node = VG_(HT_lookup)(tc_index, nraddr); node; node = node->dup) {
+      const TCRecord* rec   = node->rec;
+      const UChar*    guest = (const UChar*)rec + sizeof(TCRecord);
+      VexGuestExtents vge_tmp;
+
+      if (rec->addr != addr || rec->kind != kind
+          || rec->code_len > host_bytes_size)
+         continue;
+
+      /* Is the guest code still the same, in the same kind of
+         mapping? */
+      for (i = 0; i < rec->vge_n_used; i++) {
+         if (!extent_is_file_backed(rec->vge_base[i], rec->vge_len[i])
+             || VG_(memcmp)((void*)rec->vge_base[i], guest,
+                            rec->vge_len[i]) != 0)
+            break;
+         /* The secondary extents are the result of chasing, which
+            might no longer be allowed, eg because the chased-into
+            function has since been redirected. */
+         if (i > 0 && !chase_into_ok(chase_closure, rec->vge_base[i]))
+            break;
+         guest += rec->vge_len[i];
+      }
+      if (i < rec->vge_n_used) {
+         n_tc_stale++;
+         continue;
+      }
+
+      TCRecord__to_vge(&vge_tmp, rec);
+      if (VG_(gdbserver_instrumentation_needed)(&vge_tmp) != Vg_VgdbNo)
+         continue;
+
+      *vge             = vge_tmp;
+      VG_(memcpy)(host_bytes, guest, rec->code_len);
+      *host_bytes_used = rec->code_len;
+      *offs_profInc    = rec->offs_profInc;
+      *n_guest_instrs  = rec->n_guest_instrs;
+      n_tc_hits++;
+      return True;
+   }
+   return False;
+}
+
+void VG_(add_to_transcache) ( const VexGuestExtents* vge,
+                              Addr         nraddr,
+                              Addr         addr,
+                              UInt         kind,
+                              const UChar* host_bytes,
+                              Int          host_bytes_used,
+                              Int          offs_profInc,
+                              UInt         n_guest_instrs )
+{
+   TCRecord rec;
+   SizeT    guest_szB, szB, at;
+   UInt     i;
+
+   if (!tc_enabled)
+      return;
+
+   vg_assert(vge->n_used >= 1 && vge->n_used <= 3);
+   vg_assert(host_bytes_used > 0 && host_bytes_used < 65536);
+
+   guest_szB = 0;
+   for (i = 0; i < vge->n_used; i++) {
+      if (!extent_is_file_backed(vge->base[i], vge->len[i])) {
+         n_tc_unsuited++;
+         return;
+      }
+      guest_szB += vge->len[i];
+   }
+
+   szB = VG_ROUNDUP(sizeof(TCRecord) + guest_szB + host_bytes_used, 8);
+   if (sizeof(TCFileHeader) + tc_loaded_szB + VG_(sizeXA)(tc_new_recs) + szB
+       > TC_MAX_FILE_SZB) {
+      n_tc_unsuited++;
+      return;
+   }
+
+   VG_(memset)(&rec, 0, sizeof(rec));
+   rec.rec_szB        = szB;
+   rec.nraddr         = nraddr;
+   rec.addr           = addr;
+   rec.vge_n_used     = vge->n_used;
+   for (i = 0; i < vge->n_used; i++) {
+      rec.vge_base[i] = vge->base[i];
+      rec.vge_len[i]  = vge->len[i];
+   }
+   rec.kind           = kind;
+   rec.offs_profInc   = offs_profInc;
+   rec.n_guest_instrs = n_guest_instrs;
+   rec.code_len       = host_bytes_used;
+
+   /* Lay the record out in place, then fill in the checksum. */
+   at = VG_(sizeXA)(tc_new_recs);
+   VG_(addBytesToXA)(tc_new_recs, &rec, sizeof(rec));
+   for (i = 0; i < vge->n_used; i++)
+      VG_(addBytesToXA)(tc_new_recs, (void*)vge->base[i], vge->len[i]);
+   VG_(addBytesToXA)(tc_new_recs, host_bytes, host_bytes_used);
+   while (VG_(sizeXA)(tc_new_recs) - at < szB) {
+      UChar zero = 0;
+      VG_(addToXA)(tc_new_recs, &zero);
+   }
+   { TCRecord* recP = VG_(indexXA)(tc_new_recs, at);
+     recP->checksum = record_checksum(recP);
+   }
+   n_tc_added++;
+}
+
+
+/*------------------------------------------------------------*/
+/*--- Initialisation and stats                             ---*/
+/*------------------------------------------------------------*/
+
+void VG_(init_transcache) ( void )
+{
+   const HChar* why = NULL;
+
+   if (VG_(clo_translation_cache) == NULL)
+      return;
+
+   if (!VG_(needs).persistent_translations)
+      why = "is not supported by this tool";
+   else if (VG_(clo_smc_check) == Vg_SmcAll
+            || VG_(clo_smc_check) == Vg_SmcStack)
+      why = "cannot be used with --smc-check=all or --smc-check=stack";
+   else if (VG_(clo_vgdb) == Vg_VgdbFull)
+      why = "cannot be used with --vgdb=full";
+   if (why) {
+      VG_(umsg)("Warning: --translation-cache %s; ignored.\n", why);
+      return;
+   }
+
+   tc_filename  = VG_(expand_file_name)("--translation-cache",
+                                        VG_(clo_translation_cache));
+   tc_key       = compute_key();
+   tc_owner_pid = VG_(getpid)();
+   tc_index     = VG_(HT_construct)("transcache.index");
+   tc_new_recs  = VG_(newXA)(VG_(malloc), "transcache.new_recs",
+                             VG_(free), sizeof(UChar));
+   load_file();
+   tc_enabled   = True;
+}
+
+Bool VG_(transcache_enabled) ( void )
+{
+   return tc_enabled;
+}
+
+void VG_(print_transcache_stats) ( void )
+{
+   if (!tc_enabled)
+      return;
+   VG_(message)(Vg_DebugMsg,
+                "transcache: %'llu loaded, %'llu lookups, %'llu hits,"
+                " %'llu stale\n",
+                n_tc_loaded, n_tc_lookups, n_tc_hits, n_tc_stale);
+   VG_(message)(Vg_DebugMsg,
+                "transcache: %'llu added, %'llu not cacheable\n",
+                n_tc_added, n_tc_unsuited);
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -39,7 +39,10 @@
 #include "pub_core_libcbase.h"
 #include "pub_core_libcassert.h"
 #include "pub_core_libcprint.h"
+#include "pub_core_libcproc.h"   // VG_(read_millisecond_timer)
 #include "pub_core_options.h"
+#include "pub_core_mallocfree.h"
+#include "pub_core_hashtable.h"
 
 #include "pub_core_debuginfo.h"  // VG_(get_fnname_w_offset)
 #include "pub_core_redir.h"      // VG_(redir_do_lookup)
@@ -60,6 +63,8 @@
 
 #include "pub_core_gdbserver.h"   // VG_(instrument_for_gdbserver_if_needed)
 
+#include "pub_core_transcache.h"  // VG_(search_transcache)
+
 #include "libvex_emnote.h"        // For PPC, EmWarn_PPC64_redir_underflow
 
 /*------------------------------------------------------------*/
@@ -75,6 +80,18 @@ static ULong n_PX_VexRegUpdUnwindregsAtMemAccess = 0;
 static ULong n_PX_VexRegUpdAllregsAtMemAccess    = 0;
 static ULong n_PX_VexRegUpdAllregsAtEachInsn     = 0;
 
+/* Time spent in LibVEX_Translate, in milliseconds.  Only measured
+   with --stats=yes, since it costs two syscalls per translation.  The
+   guest thread is stalled for the whole of each translation, so the
+   maximum shows the worst pause.  Most translations take well under a
+   millisecond, but the rounding errors cancel out in the total. */
+static ULong n_timed_translations = 0;
+static ULong translate_ms_total   = 0;
+static UInt  translate_ms_max     = 0;
+
+/* Number of superblocks retranslated as hot traces. */
+static ULong n_hot_promoted = 0;
+
 void VG_(print_translation_stats) ( void )
 {
    UInt n_SP_updates = n_SP_updates_fast + n_SP_updates_generic_known
@@ -99,6 +116,62 @@ void VG_(print_translation_stats) ( void )
 
    VG_(message)(Vg_DebugMsg,
                 "translate: PX: SPonly %'llu,  UnwRegs %'llu,  AllRegs %'llu,  AllRegsAllInsns %'llu\n", n_PX_VexRegUpdSpAtMemAccess, n_PX_VexRegUpdUnwindregsAtMemAccess, n_PX_VexRegUpdAllregsAtMemAccess, n_PX_VexRegUpdAllregsAtEachInsn);
+
+   if (n_timed_translations > 0)
+      VG_(message)(Vg_DebugMsg,
+                   "translate: %'llu JIT runs took %'llu ms (max %'u ms)\n",
+                   n_timed_translations, translate_ms_total,
+                   translate_ms_max);
+
+   if (VG_(clo_hot_traces) > 0)
+      VG_(message)(Vg_DebugMsg,
+                   "translate: %'llu hot superblocks retranslated as traces\n",
+                   n_hot_promoted);
+}
+
+/*------------------------------------------------------------*/
+/*--- Hot traces                                           ---*/
+/*------------------------------------------------------------*/
+
+/* With --hot-traces=N, normal translations are made with a profile
+   counter.  Once a translation has been entered N times, it is
+   discarded, and its entry address is remembered here.  When it is
+   translated again, it is done with conditional-branch chasing
+   enabled and a higher chase threshold, so that a loop body which
+   would otherwise be split over several small superblocks is
+   optimised and instrumented as one trace.  Conditional branches are
+   chased in the direction VEX predicts statically: backward branches
+   taken, forward branches not taken.  Hot translations carry no
+   counter (unless --profile-flags also asks for one), so each entry
+   is promoted at most once. */
+static VgHashTable* hot_sbs = NULL;
+
+static Bool is_hot_sb ( Addr nraddr )
+{
+   return hot_sbs != NULL && VG_(HT_lookup)(hot_sbs, nraddr) != NULL;
+}
+
+void VG_(promote_hot_translations) ( void )
+{
+   Addr entries[64];
+   UInt n, i;
+
+   vg_assert(VG_(clo_hot_traces) > 0);
+   if (hot_sbs == NULL)
+      hot_sbs = VG_(HT_construct)("translate.hot_sbs");
+
+   n = VG_(discard_hot_translations)( VG_(clo_hot_traces), entries,
+                                      sizeof(entries)/sizeof(entries[0]),
+                                      is_hot_sb );
+   for (i = 0; i < n; i++) {
+      VgHashNode* node = VG_(malloc)("translate.promote_hot_translations.1",
+                                     sizeof(VgHashNode));
+      node->key = entries[i];
+      VG_(HT_add_node)(hot_sbs, node);
+      if (VG_(clo_verbosity) > 2)
+         VG_(message)(Vg_DebugMsg, "hot superblock at 0x%lx\n", entries[i]);
+   }
+   n_hot_promoted += n;
 }
 
 /*------------------------------------------------------------*/
@@ -206,6 +279,11 @@ static void update_SP_aliases(Long delta)
    }
 }
 
+/* Set when the translation being made embeds an ECU.  ECUs are only
+   meaningful within a single run, so such a translation must not be
+   saved in the persistent translation cache. */
+static Bool translation_has_ecus = False;
+
 /* Given a guest IP, get an origin tag for a 1-element stack trace,
    and wrap it up in an IR atom that can be passed as the origin-tag
    value for a stack-adjustment helper function. */
@@ -217,6 +295,7 @@ static IRExpr* mk_ecu_Expr ( Addr guest_IP )
    vg_assert(ec);
    ecu = VG_(get_ECU_from_ExeContext)( ec );
    vg_assert(VG_(is_plausible_ECU)(ecu));
+   translation_has_ecus = True;
    /* This is always safe to do, since ecu is only 32 bits, and
       HWord is 32 or 64. */
    return mkIRExpr_HWord( (HWord)ecu );
@@ -1487,6 +1566,7 @@ Bool VG_(translate) ( ThreadId tid,
    VexTranslateArgs   vta;
    VexTranslateResult tres;
    VgCallbackClosure  closure;
+   Bool               hot;
 
    /* Make sure Vex is initialised right. */
 
@@ -1520,6 +1600,8 @@ Bool VG_(translate) ( ThreadId tid,
 
    /* Established: (nraddr, addr, kind) */
 
+   hot = kind == T_Normal && VG_(clo_hot_traces) > 0 && is_hot_sb(nraddr);
+
    /* Printing redirection info. */
 
    if ((kind == T_Redir_Wrap || kind == T_Redir_Replace)
@@ -1760,7 +1842,9 @@ Bool VG_(translate) ( ThreadId tid,
    vta.preamble_function = preamble_fn;
    vta.traceflags        = verbosity;
    vta.sigill_diag       = VG_(clo_sigill_diag);
-   vta.addProfInc        = VG_(clo_profyle_sbs) && kind != T_NoRedir;
+   vta.addProfInc        = (VG_(clo_profyle_sbs)
+                            || (VG_(clo_hot_traces) > 0 && !hot))
+                           && kind != T_NoRedir;
 
    /* Set up the dispatch continuation-point info.  If this is a
       no-redir translation then it cannot be chained, and the chain-me
@@ -1790,8 +1874,51 @@ Bool VG_(translate) ( ThreadId tid,
    vta.disp_cp_xassisted
       = VG_(fnptr_to_fnentry)( &VG_(disp_cp_xassisted) );
 
-   /* Sheesh.  Finally, actually _do_ the translation! */
-   tres = LibVEX_Translate ( &vta );
+   /* If this code was translated in an earlier run and the result
+      was saved, use that.  Otherwise, sheesh.  Finally, actually _do_
+      the translation! */
+   if (!debugging_translation && kind != T_NoRedir && verbosity == 0
+       && !hot
+       && VG_(search_transcache)( &vge, tmpbuf, N_TMPBUF, &tmpbuf_used,
+                                  &tres.offs_profInc, &tres.n_guest_instrs,
+                                  nraddr, addr, kind,
+                                  chase_into_ok, &closure )) {
+      tres.status       = VexTransOK;
+      tres.n_sc_extents = 0;
+   } else {
+      UInt ms_start = VG_(clo_stats) ? VG_(read_millisecond_timer)() : 0;
+
+      if (hot) {
+         VexControl vcon = VG_(clo_vex_control);
+         vcon.guest_chase_cond   = True;
+         vcon.guest_chase_thresh = vcon.guest_max_insns - 1;
+         LibVEX_Update_Control(&vcon);
+      }
+
+      translation_has_ecus = False;
+      tres = LibVEX_Translate ( &vta );
+
+      if (hot)
+         LibVEX_Update_Control(&VG_(clo_vex_control));
+
+      if (VG_(clo_stats)) {
+         UInt ms = VG_(read_millisecond_timer)() - ms_start;
+         n_timed_translations++;
+         translate_ms_total += ms;
+         if (ms > translate_ms_max)
+            translate_ms_max = ms;
+      }
+
+      /* Hot traces are made with different VEX control settings, and
+         replace a translation which is already saved for nraddr. */
+      if (!debugging_translation && kind != T_NoRedir && !hot
+          && tres.status == VexTransOK && tres.n_sc_extents == 0
+          && !translation_has_ecus && VG_(transcache_enabled)()
+          && VG_(gdbserver_instrumentation_needed)(&vge) == Vg_VgdbNo)
+         VG_(add_to_transcache)( &vge, nraddr, addr, kind,
+                                 tmpbuf, tmpbuf_used,
+                                 tres.offs_profInc, tres.n_guest_instrs );
+   }
 
    vg_assert(tres.status == VexTransOK);
    vg_assert(tres.n_sc_extents >= 0 && tres.n_sc_extents <= 3);
@@ -409,6 +409,13 @@ typedef
       /* The count of tt entries with state InUse. */
       Int tt_n_inuse;
 
+      /* For choosing which sector to recycle: the value of n_in_count
+         when this sector was last (re)initialised, and a decaying count
+         of the times a thread was seen running code in it (see
+         VG_(sample_transtab_use)). */
+      ULong born;
+      UInt  n_samples;
+
       /* A list of Empty/Deleted entries, chained by tte->next_empty_tte */
       TTEno empty_tt_list;
 
@@ -435,8 +442,9 @@ typedef
    sector.  When it fills up, we move along to the next sector and
    start to fill that up, wrapping around at the end of the array.
    That way, once all N_TC_SECTORS have been bought into use for the
-   first time, and are full, we then re-use the oldest sector,
-   endlessly. 
+   first time, and are full, we then re-use a sector, endlessly.  The
+   sector re-used is normally the oldest, but pick_sector_to_recycle
+   may spare it if the program still spends its time there.
 
    When running, youngest sector should be between >= 0 and <
    N_TC_SECTORS.  The initial  value indicates the TT/TC system is
@@ -464,6 +472,11 @@ static SECno sector_search_order[MAX_N_SECTORS];
    Entries in tt_fast may refer to any valid TC entry, regardless of
    which sector it's in.  Consequently we must be very careful to
    invalidate this cache when TC entries are changed or disappear.
+   Since a translation is only ever entered in tt_fast under its own
+   .entry address, a translation can be removed from it by looking at
+   the single slot that .entry hashes to; see
+   invalidateFastCacheEntry.  Hence deleting translations, or
+   recycling a sector, does not require flushing the whole cache.
 
    A special .guest address - TRANSTAB_BOGUS_GUEST_ADDR -- must be
    pointed at to cause that cache entry to miss.  This relies on the
@@ -488,9 +501,11 @@ static Bool init_done = False;
 
 /*------------------ STATS DECLS ------------------*/
 
-/* Number of fast-cache updates and flushes done. */
+/* Number of fast-cache updates and flushes done, and of single
+   entries invalidated because their translation was deleted. */
 static ULong n_fast_flushes = 0;
 static ULong n_fast_updates = 0;
+static ULong n_fast_invalidations = 0;
 
 /* Number of full lookups done. */
 static ULong n_full_lookups = 0;
@@ -507,6 +522,8 @@ static ULong n_in_sc_count = 0;
 static ULong n_dump_count = 0;
 static ULong n_dump_osize = 0;
 static ULong n_sectors_recycled = 0;
+/* How many of those recycles picked a sector other than the oldest. */
+static ULong n_sectors_recycled_hot = 0;
 
 /* Number/osize of translations discarded due to requests to do so. */
 static ULong n_disc_count = 0;
@@ -1378,6 +1395,9 @@ static Bool sanity_check_sector_search_order ( void )
    return True;
 }
 
+/* forward */
+static Bool sanity_check_fastcache ( void );
+
 static Bool sanity_check_all_sectors ( void )
 {
    SECno   sno;
@@ -1412,6 +1432,8 @@ static Bool sanity_check_all_sectors ( void )
       return False;
    if ( !sanity_check_sector_search_order() )
       return False;
+   if ( !sanity_check_fastcache() )
+      return False;
    return True;
 }
 
@@ -1467,6 +1489,41 @@ static void setFastCacheEntry ( Addr key, ULong* tcptr )
    vg_assert(VG_(tt_fast)[cno].guest != TRANSTAB_BOGUS_GUEST_ADDR);
 }
 
+/* Remove the translation at TCPTR, whose entry is KEY, from the fast
+   cache, if it is there. */
+static inline void invalidateFastCacheEntry ( Addr key, const ULong* tcptr )
+{
+   UInt cno = (UInt)VG_TT_FAST_HASH(key);
+   if (VG_(tt_fast)[cno].guest == key
+       && VG_(tt_fast)[cno].host == (Addr)tcptr) {
+      VG_(tt_fast)[cno].guest = TRANSTAB_BOGUS_GUEST_ADDR;
+      n_fast_invalidations++;
+   }
+}
+
+/* Check that every valid fast cache entry points at the start of a
+   live translation of its guest address.  Since deleting translations
+   only invalidates the entries of the deleted translations, a stale
+   entry would be fatal.  This searches the sectors for every entry,
+   so it is expensive; it is done with --sanity-level=4 and above. */
+static Bool sanity_check_fastcache ( void )
+{
+   UInt  cno;
+   SECno sNo;
+   TTEno tteNo;
+   for (cno = 0; cno < VG_TT_FAST_SIZE; cno++) {
+      const FastCacheEntry* fce = &VG_(tt_fast)[cno];
+      if (fce->guest == TRANSTAB_BOGUS_GUEST_ADDR)
+         continue;
+      if (!find_TTEntry_from_hcode( &sNo, &tteNo, (void*)fce->host ))
+         return False;
+      if (sectors[sNo].ttC[tteNo].tcptr != (ULong*)fce->host
+          || sectors[sNo].ttC[tteNo].entry != fce->guest)
+         return False;
+   }
+   return True;
+}
+
 /* Invalidate the fast cache VG_(tt_fast). */
 static void invalidateFastCache ( void )
 {
@@ -1631,6 +1688,7 @@ static void initialiseSector ( SECno sno )
             }
             unchain_in_preparation_for_deletion(arch_host,
                                                 endness_host, sno, ei);
+            invalidateFastCacheEntry(sec->ttC[ei].entry, sec->ttC[ei].tcptr);
          } else {
             vg_assert(sec->ttC[ei].n_tte2ec == 0);
          }
@@ -1678,14 +1736,68 @@ static void initialiseSector ( SECno sno )
 
    sec->tc_next = sec->tc;
    sec->tt_n_inuse = 0;
-
-   invalidateFastCache();
+   sec->born = n_in_count;
+   sec->n_samples = 0;
 
    { Bool sane = sanity_check_sector_search_order();
      vg_assert(sane);
    }
 }
 
+/* Decide which sector to use once the youngest sector, Y, is full.
+   Sectors are brought into use in order, so if the next one has never
+   been used, take it.  Otherwise all sectors are in use and one must
+   be thrown away.  Plain round-robin would throw away the oldest, even
+   if it holds the loops the program is spending its time in, and these
+   would then immediately have to be retranslated.  Instead, treat the
+   younger half of the sectors as a nursery which is never recycled,
+   since code translated recently is likely to be needed again soon,
+   and from the older half pick the sector in which the fewest samples
+   have landed, the oldest winning any tie.  Sample counts are halved
+   at each recycle so that code which has stopped running eventually
+   loses its protection.
+
+   The older half only offers a choice if it has at least two sectors.
+   With fewer than MIN_SECTORS_TO_SPARE sectors, this is plain
+   round-robin. */
+#define MIN_SECTORS_TO_SPARE 4
+
+static SECno pick_sector_to_recycle ( SECno y )
+{
+   SECno next = y + 1 < n_sectors ? y + 1 : 0;
+   SECno victim = INV_SNO;
+   SECno sno, sno2;
+   Int   n_older;
+
+   if (sectors[next].tc == NULL || n_sectors < MIN_SECTORS_TO_SPARE)
+      return next;
+
+   for (sno = 0; sno < n_sectors; sno++) {
+      vg_assert(sectors[sno].tc != NULL);
+      if (sno == y)
+         continue;
+      n_older = 0;
+      for (sno2 = 0; sno2 < n_sectors; sno2++)
+         if (sectors[sno2].born < sectors[sno].born)
+            n_older++;
+      if (n_older >= n_sectors / 2)
+         continue;
+      if (victim == INV_SNO
+          || sectors[sno].n_samples < sectors[victim].n_samples
+          || (sectors[sno].n_samples == sectors[victim].n_samples
+              && sectors[sno].born < sectors[victim].born))
+         victim = sno;
+   }
+   vg_assert(victim != INV_SNO && victim != y);
+
+   for (sno = 0; sno < n_sectors; sno++)
+      sectors[sno].n_samples /= 2;
+
+   if (victim != next)
+      n_sectors_recycled_hot++;
+   return victim;
+}
+
 /* Add a translation of vge to TT/TC.  The translation is temporarily
    in code[0 .. code_len-1].
 
@@ -1741,10 +1853,10 @@ void VG_(add_to_transtab)( const VexGuestExtents* vge,
 
    if (tcAvailQ < reqdQ 
        || sectors[y].tt_n_inuse >= N_TTES_PER_SECTOR) {
-      /* No.  So move on to the next sector.  Either it's never been
+      /* No.  So move on to another sector.  Either it's never been
          used before, in which case it will get its tt/tc allocated
          now, or it has been used before, in which case it is set to be
-         empty, hence throwing out the oldest sector. */
+         empty, hence throwing out the least recently used sector. */
       vg_assert(tc_sector_szQ > 0);
       Int tt_loading_pct = (100 * sectors[y].tt_n_inuse) 
                            / N_HTTES_PER_SECTOR;
@@ -1757,9 +1869,7 @@ void VG_(add_to_transtab)( const VexGuestExtents* vge,
                    y, tt_loading_pct, tc_loading_pct,
                    8 * (tc_sector_szQ - tcAvailQ)/sectors[y].tt_n_inuse);
       }
-      youngest_sector++;
-      if (youngest_sector >= n_sectors)
-         youngest_sector = 0;
+      youngest_sector = pick_sector_to_recycle(y);
       y = youngest_sector;
       initialiseSector(y);
    }
@@ -1933,6 +2043,17 @@ Bool VG_(search_transtab) ( /*OUT*/Addr*  res_hcode,
 }
 
 
+/* Note that a thread is running the translation of GUEST_ADDR.  Code
+   running from chained translations and the fast cache is otherwise
+   invisible here, so the scheduler calls this periodically, to give
+   pick_sector_to_recycle a rough profile of which sectors are hot. */
+void VG_(sample_transtab_use) ( Addr guest_addr )
+{
+   SECno sno;
+   if (VG_(search_transtab)(NULL, &sno, NULL, guest_addr, False))
+      sectors[sno].n_samples++;
+}
+
 /*-------------------------------------------------------------*/
 /*--- Delete translations.                                  ---*/
 /*-------------------------------------------------------------*/
@@ -1991,6 +2112,9 @@ static void delete_tte ( /*MOD*/Sector* sec, SECno secNo, TTEno tteno,
    /* Unchain .. */
    unchain_in_preparation_for_deletion(arch_host, endness_host, secNo, tteno);
 
+   /* .. and make sure the dispatcher can't find it any more. */
+   invalidateFastCacheEntry(tteC->entry, tteC->tcptr);
+
    /* Deal with the ec-to-tte links first. */
    for (i = 0; i < tteC->n_tte2ec; i++) {
       ec_num = tteC->tte2ec_ec[i];
@@ -2202,9 +2326,6 @@ void VG_(discard_translations) ( Addr guest_start, ULong range,
 
    }
 
-   if (anyDeleted)
-      invalidateFastCache();
-
    /* don't forget the no-redir cache */
    unredir_discard_translations( guest_start, range );
 
@@ -2241,6 +2362,61 @@ void VG_(discard_translations_safely) ( Addr  start, SizeT len,
    VG_(discard_translations)(start, len, who);
 }
 
+/* Sector to be scanned by the next call to
+   VG_(discard_hot_translations). */
+static SECno next_hot_scan_sector = 0;
+
+/* Discard the translations in one sector which have been entered at
+   least THRESHOLD times, as counted by their profile counters, so
+   that they get retranslated when next needed.  Translations whose
+   entry is redirected, or for which IS_PROMOTED returns True, are
+   left alone.  The entry addresses of the discarded translations are
+   written to ENTRIES (at most N_ENTRIES of them), and their number is
+   returned.  Successive calls scan successive sectors, so that the
+   cost of each call is bounded by the size of one sector. */
+UInt VG_(discard_hot_translations) ( ULong threshold,
+                                     /*OUT*/Addr* entries, UInt n_entries,
+                                     Bool (*is_promoted)( Addr ) )
+{
+   SECno sno;
+   TTEno i;
+   UInt  n_found = 0;
+   Int   tries;
+
+   vg_assert(init_done);
+
+   /* Find the next sector in use, if any. */
+   for (tries = 0; tries < n_sectors; tries++) {
+      sno = next_hot_scan_sector;
+      next_hot_scan_sector = (next_hot_scan_sector + 1) % n_sectors;
+      if (sectors[sno].tc != NULL)
+         break;
+   }
+   if (tries == n_sectors)
+      return 0;
+
+   VexArch     arch_host = VexArch_INVALID;
+   VexArchInfo archinfo_host;
+   VG_(bzero_inline)(&archinfo_host, sizeof(archinfo_host));
+   VG_(machine_get_VexArchInfo)( &arch_host, &archinfo_host );
+   VexEndness endness_host = archinfo_host.endness;
+
+   Sector* sec = &sectors[sno];
+   for (i = 0; i < N_TTES_PER_SECTOR && n_found < n_entries; i++) {
+      TTEntryH* tteH = &sec->ttH[i];
+      TTEntryC* tteC = &sec->ttC[i];
+      if (tteH->status != InUse
+          || tteC->usage.prof.count < threshold
+          || tteH->vge_base[0] != tteC->entry
+          || is_promoted(tteC->entry))
+         continue;
+      entries[n_found++] = tteC->entry;
+      delete_tte( sec, sno, i, arch_host, endness_host );
+   }
+
+   return n_found;
+}
+
 /*------------------------------------------------------------*/
 /*--- AUXILIARY: the unredirected TT/TC                    ---*/
 /*------------------------------------------------------------*/
@@ -2571,8 +2747,9 @@ void VG_(print_tt_tc_stats) ( void )
       "    tt/tc: %'llu tt lookups requiring %'llu probes\n",
       n_full_lookups, n_lookup_probes );
    VG_(message)(Vg_DebugMsg,
-      "    tt/tc: %'llu fast-cache updates, %'llu flushes\n",
-      n_fast_updates, n_fast_flushes );
+      "    tt/tc: %'llu fast-cache updates, %'llu flushes, "
+      "%'llu entries invalidated\n",
+      n_fast_updates, n_fast_flushes, n_fast_invalidations );
 
    VG_(message)(Vg_DebugMsg,
                 " transtab: new        %'llu "
@@ -2584,8 +2761,9 @@ void VG_(print_tt_tc_stats) ( void )
                 n_in_tsize / (n_in_count ? n_in_count : 1));
    VG_(message)(Vg_DebugMsg,
                 " transtab: dumped     %'llu (%'llu -> ?" "?) "
-                "(sectors recycled %'llu)\n",
-                n_dump_count, n_dump_osize, n_sectors_recycled );
+                "(sectors recycled %'llu, %'llu not the oldest)\n",
+                n_dump_count, n_dump_osize, n_sectors_recycled,
+                n_sectors_recycled_hot );
    VG_(message)(Vg_DebugMsg,
                 " transtab: discarded  %'llu (%'llu -> ?" "?)\n",
                 n_disc_count, n_disc_osize );
@@ -94,6 +94,10 @@ Bool VG_(gdbserver_point) (PointKind kind, Bool insert,
 /* True if there is a breakpoint at addr. */
 Bool VG_(has_gdbserver_breakpoint) (Addr addr);
 
+/* Indicates whether a translation of vge would be instrumented
+   for gdbserver by VG_(instrument_for_gdbserver_if_needed). */
+VgVgdb VG_(gdbserver_instrumentation_needed) (const VexGuestExtents* vge);
+
 /* Entry point invoked by vgdb when it uses ptrace to cause a gdbserver
    invocation. A magic value is passed by vgdb in check as a verification
    that the call has been properly pushed by vgdb. */
@@ -321,6 +321,14 @@ extern UInt VG_(clo_num_transtab_sectors);
    provided default. */
 extern UInt VG_(clo_avg_transtab_entry_size);
 
+/* File in which to save translations for reuse by later runs, or NULL
+   if translations are not to be saved. */
+extern const HChar* VG_(clo_translation_cache);
+
+/* Retranslate superblocks entered this many times as longer traces.
+   0 means never. */
+extern UInt VG_(clo_hot_traces);
+
 /* Only client requested fixed mapping can be done below 
    VG_(clo_aspacem_minAddr). */
 extern Addr VG_(clo_aspacem_minAddr);
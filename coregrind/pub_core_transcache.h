@@ -0,0 +1,96 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Persistent, on-disk cache of translations.                   ---*/
+/*---                                       pub_core_transcache.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Valgrind, a dynamic binary instrumentation
+   framework.
+
+   Copyright (C) 2000-2017 Julian Seward
+      jseward@acm.org
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#ifndef __PUB_CORE_TRANSCACHE_H
+#define __PUB_CORE_TRANSCACHE_H
+
+#include "pub_core_basics.h"   // VG_ macro
+#include "libvex.h"            // VexGuestExtents
+
+//--------------------------------------------------------------------
+// PURPOSE: This module keeps a file of translations made in earlier
+// runs of the same tool, with the same options, on the same host.  A
+// translation from the file can be used instead of running the JIT,
+// provided the guest code it was made from is still byte-for-byte
+// identical and still lives in a file-backed mapping at the same
+// address.  This is enabled by --translation-cache=<file>, and only
+// for tools which declare VG_(needs_persistent_translations).
+//--------------------------------------------------------------------
+
+/* Reads the cache file, if any.  Must be called after the tool's
+   post_clo_init, since that is when the tool's needs are final. */
+extern void VG_(init_transcache) ( void );
+
+/* Look for a cached translation of guest code at ADDR, requested via
+   NRADDR with redirection kind KIND.  On success, the host code is
+   copied to HOST_BYTES and the other OUT parameters are filled in as
+   LibVEX_Translate would have done.  CHASE_INTO_OK is used to check
+   that the chasing decisions made when the translation was created
+   are still valid now. */
+extern
+Bool VG_(search_transcache) ( /*OUT*/VexGuestExtents* vge,
+                              /*OUT*/UChar* host_bytes,
+                              Int           host_bytes_size,
+                              /*OUT*/Int*   host_bytes_used,
+                              /*OUT*/Int*   offs_profInc,
+                              /*OUT*/UInt*  n_guest_instrs,
+                              Addr          nraddr,
+                              Addr          addr,
+                              UInt          kind,
+                              Bool (*chase_into_ok)(void*,Addr),
+                              void*         chase_closure );
+
+/* Remember a translation just made by the JIT, so that it can be
+   written to the cache file at exit.  Translations of code which is
+   not file-backed are silently ignored. */
+extern
+void VG_(add_to_transcache) ( const VexGuestExtents* vge,
+                              Addr         nraddr,
+                              Addr         addr,
+                              UInt         kind,
+                              const UChar* host_bytes,
+                              Int          host_bytes_used,
+                              Int          offs_profInc,
+                              UInt         n_guest_instrs );
+
+/* Is the cache in use for this run? */
+extern Bool VG_(transcache_enabled) ( void );
+
+/* Write out the translations made in this run.  Called at exit. */
+extern void VG_(transcache_shutdown) ( void );
+
+extern void VG_(print_transcache_stats) ( void );
+
+#endif   // __PUB_CORE_TRANSCACHE_H
+
+/*--------------------------------------------------------------------*/
+/*--- end                                    pub_core_transcache.h ---*/
+/*--------------------------------------------------------------------*/
@@ -48,6 +48,10 @@ Bool VG_(translate) ( ThreadId tid,
 
 extern void VG_(print_translation_stats) ( void );
 
+/* Called by the scheduler from time to time, with --hot-traces, to
+   retranslate hot superblocks as longer traces. */
+extern void VG_(promote_hot_translations) ( void );
+
 #endif   // __PUB_CORE_TRANSLATE_H
 
 /*--------------------------------------------------------------------*/
@@ -110,9 +110,18 @@ extern Bool VG_(search_transtab) ( /*OUT*/Addr*  res_hcode,
                                    Addr          guest_addr, 
                                    Bool          upd_cache );
 
+extern void VG_(sample_transtab_use) ( Addr guest_addr );
 extern void VG_(discard_translations) ( Addr  start, ULong range,
                                         const HChar* who );
 
+/* Discard translations, in one sector per call, which have been
+   entered at least THRESHOLD times according to their profile
+   counters.  See m_transtab.c for details. */
+extern UInt VG_(discard_hot_translations) ( ULong threshold,
+                                            /*OUT*/Addr* entries,
+                                            UInt n_entries,
+                                            Bool (*is_promoted)( Addr ) );
+
 extern void VG_(print_tt_tc_stats) ( void );
 
 extern UInt VG_(get_bbs_translated) ( void );
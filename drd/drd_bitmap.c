@@ -38,6 +38,7 @@
 
 static void bm2_merge(struct bitmap2* const bm2l,
                       const struct bitmap2* const bm2r);
+static Bool bm2_is_empty(const struct bitmap2* const bm2);
 static void bm2_print(const struct bitmap2* const bm2);
 
 
@@ -512,8 +513,17 @@ Bool DRD_(bm_has_any_access)(struct bitmap* const bm,
          tl_assert(b_start < b_end);
          tl_assert(address_lsb(b_start) <= address_lsb(b_end - 1));
 
-         for (b0 = address_lsb(b_start); b0 <= address_lsb(b_end - 1); b0++)
+         for (b0 = address_lsb(b_start); b0 <= address_lsb(b_end - 1); )
          {
+            /* Test a whole UWord at once where the range covers it. */
+            if (uword_lsb(b0) == 0
+                && b0 + BITS_PER_UWORD - 1 <= address_lsb(b_end - 1))
+            {
+               if (p1->bm0_r[uword_msb(b0)] | p1->bm0_w[uword_msb(b0)])
+                  return True;
+               b0 += BITS_PER_UWORD;
+               continue;
+            }
             /*
              * Note: the statement below uses a binary or instead of a logical
              * or on purpose.
@@ -522,6 +532,7 @@ Bool DRD_(bm_has_any_access)(struct bitmap* const bm,
             {
                return True;
             }
+            b0++;
          }
       }
    }
@@ -1032,6 +1043,12 @@ void DRD_(bm_merge2)(struct bitmap* const lhs, struct bitmap* const rhs)
 
    for ( ; (bm2r = VG_(OSetGen_Next)(rhs->oset)) != 0; )
    {
+      /*
+       * Second-level bitmaps whose accesses have all been cleared are left
+       * in place, and merging them would only add empty copies to lhs.
+       */
+      if (bm2_is_empty(bm2r))
+         continue;
       bm2l = VG_(OSetGen_Lookup)(lhs->oset, &bm2r->addr);
       if (bm2l)
       {
@@ -1141,9 +1158,7 @@ void DRD_(bm_remove_cleared_marked)(struct bitmap* bm)
    for ( ; (bm2 = VG_(OSetGen_Next)(bm->oset)) != 0; )
    {
       const UWord a1 = bm2->addr;
-      if (bm2->recalc
-          && ! DRD_(bm_has_any_access(bm, make_address(a1, 0),
-                                      make_address(a1 + 1, 0))))
+      if (bm2->recalc && bm2_is_empty(bm2))
       {
          bm2_remove(bm, a1);
          VG_(OSetGen_ResetIterAt)(bm->oset, &a1);
@@ -1187,16 +1202,18 @@ int DRD_(bm_has_races)(struct bitmap* const lhs, struct bitmap* const rhs)
 
       for (k = 0; k < BITMAP1_UWORD_COUNT; k++)
       {
+         /* One bit per address: the RW / WR / WW patterns of HAS_RACE(). */
+         UWord const races
+            = (bm1l->bm0_w[k] & (bm1r->bm0_r[k] | bm1r->bm0_w[k]))
+            | (bm1l->bm0_r[k] & bm1r->bm0_w[k]);
          unsigned b;
+
+         if (races == 0)
+            continue;
          for (b = 0; b < BITS_PER_UWORD; b++)
          {
-            UWord const access_mask
-               = ((bm1l->bm0_r[k] & bm0_mask(b)) ? LHS_R : 0)
-               | ((bm1l->bm0_w[k] & bm0_mask(b)) ? LHS_W : 0)
-               | ((bm1r->bm0_r[k] & bm0_mask(b)) ? RHS_R : 0)
-               | ((bm1r->bm0_w[k] & bm0_mask(b)) ? RHS_W : 0);
             Addr const a = make_address(bm2l->addr, k * BITS_PER_UWORD | b);
-            if (HAS_RACE(access_mask) && ! DRD_(is_suppressed)(a, a + 1))
+            if ((races & bm0_mask(b)) && ! DRD_(is_suppressed)(a, a + 1))
             {
                return 1;
             }
@@ -1278,3 +1295,23 @@ void bm2_merge(struct bitmap2* const bm2l, const struct bitmap2* const bm2r)
       bm2l->bm1.bm0_w[k] |= bm2r->bm1.bm0_w[k];
    }
 }
+
+/**
+ * Report whether *bm2 does not contain any access.
+ *
+ * This scans the bitmap instead of keeping a summary bit in struct bitmap2.
+ * The callers ask about bitmaps from which accesses have been cleared, and
+ * a bit that is set on access could only be reset on clearing by scanning
+ * the bitmap there. Setting it would also add a store to every access.
+ */
+static Bool bm2_is_empty(const struct bitmap2* const bm2)
+{
+   UWord any = 0;
+   unsigned k;
+
+   for (k = 0; k < BITMAP1_UWORD_COUNT; k++)
+   {
+      any |= bm2->bm1.bm0_r[k] | bm2->bm1.bm0_w[k];
+   }
+   return any == 0;
+}
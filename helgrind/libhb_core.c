@@ -211,16 +211,34 @@ typedef
 
 // baseline: 5, 9
 #define FI_LINE_SZB_LOG2  5
-#define FI_NUM_LINES_LOG2 10
+
+/* The number of lines in a filter starts at 2^FI_MIN_NUM_LINES_LOG2
+   and is doubled, up to 2^FI_MAX_NUM_LINES_LOG2, for threads whose
+   accesses conflict in it a lot.  See Filter__fill. */
+#define FI_MIN_NUM_LINES_LOG2 10
+#define FI_MAX_NUM_LINES_LOG2 13
+
+/* A filter is grown when, over a period in which conflict misses have
+   evicted as many lines as the filter holds, those misses were more
+   than 1/FI_GROW_RATIO of all filtered accesses. */
+#define FI_GROW_RATIO     16
+
+/* How many filled lines a filter remembers, so that clearing it after
+   only a few accesses does not have to visit every tag. */
+#define FI_N_DIRTY        32
 
 #define FI_LINE_SZB       (1 << FI_LINE_SZB_LOG2)
-#define FI_NUM_LINES      (1 << FI_NUM_LINES_LOG2)
+#define FI_NUM_LINES(_fi) ((_fi)->lineno_mask + 1)
 
 #define FI_TAG_MASK        (~(Addr)(FI_LINE_SZB - 1))
 #define FI_GET_TAG(_a)     ((_a) & FI_TAG_MASK)
 
-#define FI_GET_LINENO(_a)  ( ((_a) >> FI_LINE_SZB_LOG2) \
-                             & (Addr)(FI_NUM_LINES-1) )
+#define FI_GET_LINENO(_fi,_a)  ( ((_a) >> FI_LINE_SZB_LOG2) \
+                                 & (_fi)->lineno_mask )
+
+/* A tag which cannot match anything, since it is not aligned to the
+   start of a line. */
+#define FI_INVALID_TAG    ((Addr)1)
 
 
 /* In the lines, each 8 bytes are treated individually, and are mapped
@@ -248,8 +266,19 @@ typedef
 
 typedef
    struct {
-      Addr   tags[FI_NUM_LINES];
-      FiLine lines[FI_NUM_LINES];
+      /* FI_NUM_LINES - 1.  The number of lines is a power of 2. */
+      UWord   lineno_mask;
+      Addr*   tags;
+      FiLine* lines;
+      /* Line numbers of the lines filled since the last clear.  If
+         n_dirty is FI_N_DIRTY + 1, more lines than that have been
+         filled, and the whole filter must be cleared. */
+      UWord   n_dirty;
+      UShort  dirty[FI_N_DIRTY];
+      /* Conflict misses since the last grow check, and the value of
+         stats__f_ac at that check. */
+      UWord   n_evictions;
+      UWord   ac_at_check;
    }
    Filter;
 
@@ -2089,9 +2118,12 @@ static void verydead_thread_table_sort_and_check (XArray* thrids)
 /* A VTS contains .ts, its vector clock, and also .id, a field to hold
    a backlink for the caller's convenience.  Since we have no idea
    what to set that to in the library, it always gets set to
-   VtsID_INVALID. */
+   VtsID_INVALID.  .next and .hash make a VTS usable as a node of
+   vts_set, which is a VgHashTable keyed by VTS__hash. */
 typedef
-   struct {
+   struct _VTS {
+      struct _VTS* next;
+      UWord    hash;
       VtsID    id;
       UInt     usedTS;
       UInt     sizeTS;
@@ -2127,8 +2159,9 @@ static void VTS__tick ( /*OUT*/VTS* out, Thr* me, VTS* vts );
 
 /* Create in 'out' a VTS which is the join (max) of 'a' and
    'b'. Caller must have pre-allocated 'out' sufficiently big to hold
-   the result in all possible cases. */
-static void VTS__join ( /*OUT*/VTS* out, VTS* a, VTS* b );
+   the result in all possible cases.  Returns 1 if the result is
+   structurally identical to 'a', 2 if it is to 'b', and 0 otherwise. */
+static UInt VTS__join ( /*OUT*/VTS* out, VTS* a, VTS* b );
 
 /* Compute the partial ordering relation of the two args.  Although we
    could be completely general and return an enumeration value (EQ,
@@ -2258,6 +2291,19 @@ static VTS* VTS__subtract ( const HChar* who, VTS* vts, XArray* thridsToDel )
 }
 
 
+/* Hash the contents of this VTS, for use as its vts_set key. */
+static UWord VTS__hash ( VTS* vts )
+{
+   UWord h = vts->usedTS;
+   UInt  i;
+   for (i = 0; i < vts->usedTS; i++) {
+      h = (h << 5) ^ (h >> (8 * sizeof(UWord) - 5));
+      h ^= (UWord)vts->ts[i].thrid * 0x9E3779B1U ^ (UWord)vts->ts[i].tym;
+   }
+   return h;
+}
+
+
 /* Delete this VTS in its entirety.
 */
 static void VTS__delete ( VTS* vts )
@@ -2363,14 +2409,16 @@ static void VTS__tick ( /*OUT*/VTS* out, Thr* me, VTS* vts )
 
 
 /* Return a new VTS constructed as the join (max) of the 2 args.
-   Neither arg is modified.
+   Neither arg is modified.  Also say whether one of the args is the
+   join already, so that the caller need not look it up.
 */
-static void VTS__join ( /*OUT*/VTS* out, VTS* a, VTS* b )
+static UInt VTS__join ( /*OUT*/VTS* out, VTS* a, VTS* b )
 {
    UInt     ia, ib, useda, usedb;
    ULong    tyma, tymb, tymMax;
    ThrID    thrid;
    UInt     ncommon = 0;
+   Bool     a_geq = True, b_geq = True;
 
    stats__vts__join++;
 
@@ -2454,12 +2502,18 @@ static void VTS__join ( /*OUT*/VTS* out, VTS* a, VTS* b )
          out->ts[hi].thrid = thrid;
          out->ts[hi].tym   = tymMax;
       }
+      if (tyma < tymb) a_geq = False;
+      if (tymb < tyma) b_geq = False;
 
    }
 
    tl_assert(is_sane_VTS(out));
    tl_assert(out->usedTS <= out->sizeTS);
    tl_assert(out->usedTS == useda + usedb - ncommon);
+
+   if (a_geq && out->usedTS == useda) return 1;
+   if (b_geq && out->usedTS == usedb) return 2;
+   return 0;
 }
 
 
@@ -2700,14 +2754,14 @@ static void VTS__declare_thread_very_dead ( Thr* thr )
 //                                                     //
 /////////////////////////////////////////////////////////
 
-static WordFM* /* WordFM VTS* void */ vts_set = NULL;
+/* Keyed by VTS__hash, so that a lookup costs one structural compare
+   rather than one per tree level. */
+static VgHashTable* /* of VTS */ vts_set = NULL;
 
 static void vts_set_init ( void )
 {
    tl_assert(!vts_set);
-   vts_set = VG_(newFM)( HG_(zalloc), "libhb.vts_set_init.1",
-                         HG_(free),
-                         (Word(*)(UWord,UWord))VTS__cmp_structural );
+   vts_set = VG_(HT_construct)( "libhb.vts_set_init.1" );
 }
 
 /* Given a VTS, look in vts_set to see if we already have a
@@ -2716,23 +2770,25 @@ static void vts_set_init ( void )
    set, and return (False, pointer to the clone). */
 static Bool vts_set__find__or__clone_and_add ( /*OUT*/VTS** res, VTS* cand )
 {
-   UWord keyW, valW;
+   VTS* found;
    stats__vts_set__focaa++;
    tl_assert(cand->id == VtsID_INVALID);
    /* lookup cand (by value) */
-   if (VG_(lookupFM)( vts_set, &keyW, &valW, (UWord)cand )) {
-      /* found it */
-      tl_assert(valW == 0);
+   cand->hash = VTS__hash(cand);
+   found = VG_(HT_gen_lookup)( vts_set, cand,
+                               (HT_Cmp_t)VTS__cmp_structural );
+   if (found) {
       /* if this fails, cand (by ref) was already present (!) */
-      tl_assert(keyW != (UWord)cand);
-      *res = (VTS*)keyW;
+      tl_assert(found != cand);
+      *res = found;
       return True;
    } else {
       /* not present.  Clone, add and return address of clone. */
       stats__vts_set__focaa_a++;
       VTS* clone = VTS__clone( "libhb.vts_set_focaa.1", cand );
       tl_assert(clone != cand);
-      VG_(addToFM)( vts_set, (UWord)clone, 0/*val is unused*/ );
+      clone->hash = cand->hash;
+      VG_(HT_add_node)( vts_set, clone );
       *res = clone;
       return False;
    }
@@ -2894,7 +2950,7 @@ static void show_vts_stats ( const HChar* caller )
    UWord nSet, nTab, nLive;
    ULong totrc;
    UWord n, i;
-   nSet = VG_(sizeFM)( vts_set );
+   nSet = VG_(HT_count_nodes)( vts_set );
    nTab = VG_(sizeXA)( vts_tab );
    totrc = 0;
    nLive = 0;
@@ -2985,8 +3041,7 @@ static void vts_tab__do_GC ( Bool show_stats )
       free list, removed from vts_set, and deleted. */
    nFreed = 0;
    for (i = 0; i < nTab; i++) {
-      Bool present;
-      UWord oldK = 0, oldV = 12345;
+      VTS* present;
       VtsTE* te = VG_(indexXA)( vts_tab, i );
       if (te->vts == NULL) {
          tl_assert(te->rc == 0);
@@ -2997,11 +3052,10 @@ static void vts_tab__do_GC ( Bool show_stats )
       /* Ok, we got one we can free. */
       tl_assert(te->vts->id == i);
       /* first, remove it from vts_set. */
-      present = VG_(delFromFM)( vts_set,
-                                &oldK, &oldV, (UWord)te->vts );
+      present = VG_(HT_gen_remove)( vts_set, te->vts,
+                                    (HT_Cmp_t)VTS__cmp_structural );
       tl_assert(present); /* else it isn't in vts_set ?! */
-      tl_assert(oldV == 0); /* no info stored in vts_set val fields */
-      tl_assert(oldK == (UWord)te->vts); /* else what did delFromFM find?! */
+      tl_assert(present == te->vts); /* else what did HT_gen_remove find?! */
       /* now free the VTS itself */
       VTS__delete(te->vts);
       te->vts = NULL;
@@ -3081,11 +3135,8 @@ static void vts_tab__do_GC ( Bool show_stats )
       = VG_(newXA)( HG_(zalloc), "libhb.vts_tab__do_GC.new_tab",
                     HG_(free), sizeof(VtsTE) );
 
-   /* WordFM VTS* void */
-   WordFM* new_set
-      = VG_(newFM)( HG_(zalloc), "libhb.vts_tab__do_GC.new_set",
-                    HG_(free),
-                    (Word(*)(UWord,UWord))VTS__cmp_structural );
+   VgHashTable* /* of VTS */ new_set
+      = VG_(HT_construct)( "libhb.vts_tab__do_GC.new_set" );
 
    /* Visit each old VTS.  For each one:
 
@@ -3095,11 +3146,11 @@ static void vts_tab__do_GC ( Bool show_stats )
         Nothing (not present) or the new VtsID for it.
 
       * if not present, allocate a new VtsID for it, insert (pruned
-        VTS, new VtsID) in the tree, and set
+        VTS, new VtsID) in new_set, and set
         remap_table[old VtsID] = new VtsID.
 
       * if present, set remap_table[old VtsID] = new VtsID, where
-        new VtsID was determined by the tree lookup.  Then free up
+        new VtsID was determined by the new_set lookup.  Then free up
         the clone.
    */
 
@@ -3132,17 +3183,15 @@ static void vts_tab__do_GC ( Bool show_stats )
       tl_assert(*(ULong*)(&new_vts->ts[new_vts->usedTS])
                 == 0x0ddC0ffeeBadF00dULL);
 
-      /* Get rid of the old VTS and the tree entry.  It's a bit more
+      /* Get rid of the old VTS and the vts_set entry.  It's a bit more
          complex to incrementally delete the VTSs now than to nuke
          them all after we're done, but the upside is that we don't
          wind up temporarily storing potentially two complete copies
          of each VTS and hence spiking memory use. */
-      UWord oldK = 0, oldV = 12345;
-      Bool  present = VG_(delFromFM)( vts_set,
-                                      &oldK, &oldV, (UWord)old_vts );
+      VTS* present = VG_(HT_gen_remove)( vts_set, old_vts,
+                                         (HT_Cmp_t)VTS__cmp_structural );
       tl_assert(present); /* else it isn't in vts_set ?! */
-      tl_assert(oldV == 0); /* no info stored in vts_set val fields */
-      tl_assert(oldK == (UWord)old_vts); /* else what did delFromFM find?! */
+      tl_assert(present == old_vts); /* else what did HT_gen_remove find?! */
       /* now free the VTS itself */
       VTS__delete(old_vts);
       old_te->vts = NULL;
@@ -3154,23 +3203,19 @@ static void vts_tab__do_GC ( Bool show_stats )
          structurally identical version is already present in new_set.
          If so, delete the one we just made and move on; if not, add
          it. */
-      VTS*  identical_version = NULL;
-      UWord valW = 12345;
-      if (VG_(lookupFM)(new_set, (UWord*)&identical_version, &valW,
-                        (UWord)new_vts)) {
+      VTS*  identical_version;
+      new_vts->hash = VTS__hash(new_vts);
+      identical_version = VG_(HT_gen_lookup)( new_set, new_vts,
+                                              (HT_Cmp_t)VTS__cmp_structural );
+      if (identical_version) {
          // already have it
-         tl_assert(valW == 0);
-         tl_assert(identical_version != NULL);
          tl_assert(identical_version != new_vts);
          VTS__delete(new_vts);
          new_vts = identical_version;
          tl_assert(new_vts->id != VtsID_INVALID);
       } else {
-         tl_assert(valW == 12345);
-         tl_assert(identical_version == NULL);
          new_vts->id = new_VtsID_ctr++;
-         Bool b = VG_(addToFM)(new_set, (UWord)new_vts, 0);
-         tl_assert(!b);
+         VG_(HT_add_node)( new_set, new_vts );
          VtsTE new_te;
          new_te.vts      = new_vts;
          new_te.rc       = 0;
@@ -3204,14 +3249,14 @@ static void vts_tab__do_GC ( Bool show_stats )
    /* At this point, we have:
       * the old VTS table, with its u.remap entries set,
         and with all .vts == NULL.
-      * the old VTS tree should be empty, since it and the old VTSs
+      * the old VTS set should be empty, since it and the old VTSs
         it contained have been incrementally deleted was we worked
         through the old table.
       * the new VTS table, with all .rc == 0, all u.freelink and u.remap
         == VtsID_INVALID. 
-      * the new VTS tree.
+      * the new VTS set.
    */
-   tl_assert( VG_(sizeFM)(vts_set) == 0 );
+   tl_assert( VG_(HT_count_nodes)(vts_set) == 0 );
 
    /* Now actually apply the mapping. */
    /* Visit all the VtsIDs in the entire system.  Where do we expect
@@ -3294,7 +3339,7 @@ static void vts_tab__do_GC ( Bool show_stats )
    }
 
    /* Install the new table and set. */
-   VG_(deleteFM)(vts_set, NULL/*kFin*/, NULL/*vFin*/);
+   VG_(HT_destruct)(vts_set, NULL);
    vts_set = new_set;
    VG_(deleteXA)( vts_tab );
    vts_tab = new_tab;
@@ -3307,21 +3352,17 @@ static void vts_tab__do_GC ( Bool show_stats )
    /* Sanity check vts_set and vts_tab. */
 
    /* Because all the live entries got slid down to the bottom of vts_tab: */
-   tl_assert( VG_(sizeXA)( vts_tab ) == VG_(sizeFM)( vts_set ));
+   tl_assert( VG_(sizeXA)( vts_tab ) == VG_(HT_count_nodes)( vts_set ));
 
    /* Assert that the vts_tab and vts_set entries point at each other
       in the required way */
-   UWord wordK = 0, wordV = 0;
-   VG_(initIterFM)( vts_set );
-   while (VG_(nextIterFM)( vts_set, &wordK, &wordV )) {
-      tl_assert(wordK != 0);
-      tl_assert(wordV == 0);
-      VTS* vts = (VTS*)wordK;
+   VTS* vts;
+   VG_(HT_ResetIter)( vts_set );
+   while ((vts = VG_(HT_Next)( vts_set ))) {
       tl_assert(vts->id != VtsID_INVALID);
       VtsTE* te = VG_(indexXA)( vts_tab, vts->id );
       tl_assert(te->vts == vts);
    }
-   VG_(doneIterFM)( vts_set );
 
    /* Also iterate over the table, and check each entry is
       plausible. */
@@ -3368,6 +3409,7 @@ static ULong stats__cmpLEQ_queries = 0;
 static ULong stats__cmpLEQ_misses  = 0;
 static ULong stats__join2_queries  = 0;
 static ULong stats__join2_misses   = 0;
+static ULong stats__join2_dominated = 0;
 
 static inline UInt ROL32 ( UInt w, Int n ) {
    w = (w << n) | (w >> (32-n));
@@ -3474,8 +3516,14 @@ static VtsID VtsID__join2_WRK ( VtsID vi1, VtsID vi2 ) {
    vts1 = VtsID__to_VTS(vi1);
    vts2 = VtsID__to_VTS(vi2);
    temp_max_sized_VTS->usedTS = 0;
-   VTS__join(temp_max_sized_VTS, vts1,vts2);
-   res = vts_tab__find__or__clone_and_add(temp_max_sized_VTS);
+   switch (VTS__join(temp_max_sized_VTS, vts1,vts2)) {
+      /* If one arg dominates the other, the join is that arg, and we
+         can avoid looking it up in vts_set. */
+      case 1:  res = vi1; stats__join2_dominated++; break;
+      case 2:  res = vi2; stats__join2_dominated++; break;
+      default: res = vts_tab__find__or__clone_and_add(temp_max_sized_VTS);
+               break;
+   }
    ////++
    join2_cache[hash].vi1 = vi1;
    join2_cache[hash].vi2 = vi2;
@@ -3535,28 +3583,124 @@ static Thr* VtsID__findFirst_notLEQ ( VtsID vi1, VtsID vi2 )
 //                                                     //
 /////////////////////////////////////////////////////////
 
+static UWord stats__f_ac = 0; // # filtered accesses
+static UWord stats__f_sk = 0; // # of those skipped
+static UWord stats__filter_evictions      = 0; // # conflict misses
+static UWord stats__filter_clears         = 0; // # Filter__clear
+static UWord stats__filter_clears_partial = 0; // # of those done by dirty list
+static UWord stats__filter_grows          = 0; // # Filter__grow
+
+static void Filter__init ( Filter* fi, UWord num_lines_log2 )
+{
+   UWord i, num_lines = 1UL << num_lines_log2;
+   fi->lineno_mask = num_lines - 1;
+   fi->tags  = HG_(zalloc)( "libhb.Filter__init.1 (tags)",
+                            num_lines * sizeof(Addr) );
+   fi->lines = HG_(zalloc)( "libhb.Filter__init.2 (lines)",
+                            num_lines * sizeof(FiLine) );
+   for (i = 0; i < num_lines; i++)
+      fi->tags[i] = FI_INVALID_TAG;
+   fi->n_dirty     = 0;
+   fi->n_evictions = 0;
+   fi->ac_at_check = stats__f_ac;
+}
+
+static Filter* Filter__new ( void )
+{
+   Filter* fi = HG_(zalloc)( "libhb.Filter__new.1", sizeof(Filter) );
+   Filter__init( fi, FI_MIN_NUM_LINES_LOG2 );
+   return fi;
+}
+
+static void Filter__delete ( Filter* fi )
+{
+   HG_(free)( fi->tags );
+   HG_(free)( fi->lines );
+   HG_(free)( fi );
+}
+
 /* Forget everything we know -- clear the filter and let everything
    through.  This needs to be as fast as possible, since it is called
    every time the running thread changes, and every time a thread's
    vector clocks change, which can be quite frequent.  The obvious
    fast way to do this is simply to stuff in tags which we know are
    not going to match anything, since they're not aligned to the start
-   of a line. */
+   of a line.  And if only a few lines have been filled since the
+   last clear, we only need to do that for them. */
 static void Filter__clear ( Filter* fi, const HChar* who )
 {
    UWord i;
    if (0) VG_(printf)("  Filter__clear(%p, %s)\n", fi, who);
-   for (i = 0; i < FI_NUM_LINES; i += 8) {
-      fi->tags[i+0] = 1; /* impossible value -- cannot match */
-      fi->tags[i+1] = 1;
-      fi->tags[i+2] = 1;
-      fi->tags[i+3] = 1;
-      fi->tags[i+4] = 1;
-      fi->tags[i+5] = 1;
-      fi->tags[i+6] = 1;
-      fi->tags[i+7] = 1;
+   stats__filter_clears++;
+   if (fi->n_dirty <= FI_N_DIRTY) {
+      for (i = 0; i < fi->n_dirty; i++)
+         fi->tags[fi->dirty[i]] = FI_INVALID_TAG;
+      fi->n_dirty = 0;
+      stats__filter_clears_partial++;
+      return;
+   }
+   for (i = 0; i < FI_NUM_LINES(fi); i += 8) {
+      fi->tags[i+0] = FI_INVALID_TAG;
+      fi->tags[i+1] = FI_INVALID_TAG;
+      fi->tags[i+2] = FI_INVALID_TAG;
+      fi->tags[i+3] = FI_INVALID_TAG;
+      fi->tags[i+4] = FI_INVALID_TAG;
+      fi->tags[i+5] = FI_INVALID_TAG;
+      fi->tags[i+6] = FI_INVALID_TAG;
+      fi->tags[i+7] = FI_INVALID_TAG;
+   }
+   tl_assert(i == FI_NUM_LINES(fi));
+   fi->n_dirty = 0;
+}
+
+/* Called every time conflict misses have evicted as many lines as
+   the filter holds.  If those misses were a large fraction of the
+   accesses made in the meantime, double the size of the filter.  Its
+   contents are simply dropped; that is always safe. */
+static void Filter__maybe_grow ( Filter* fi )
+{
+   UWord num_lines_log2 = VG_(log2)( FI_NUM_LINES(fi) );
+   UWord n_ac = stats__f_ac - fi->ac_at_check;
+
+   if (num_lines_log2 < FI_MAX_NUM_LINES_LOG2
+       && fi->n_evictions * FI_GROW_RATIO > n_ac) {
+      HG_(free)( fi->tags );
+      HG_(free)( fi->lines );
+      Filter__init( fi, num_lines_log2 + 1 );
+      stats__filter_grows++;
+      return;
    }
-   tl_assert(i == FI_NUM_LINES);
+   fi->n_evictions = 0;
+   fi->ac_at_check = stats__f_ac;
+}
+
+/* Handle a filter miss on 'atag': claim the line for it, with no R or
+   W bits set, and return that line. */
+static FiLine* Filter__fill ( Filter* fi, Addr atag )
+{
+   UWord   lineno = FI_GET_LINENO(fi, atag);
+   FiLine* line;
+   UWord   i;
+
+   if (fi->tags[lineno] != FI_INVALID_TAG) {
+      stats__filter_evictions++;
+      if (UNLIKELY(++fi->n_evictions >= FI_NUM_LINES(fi))) {
+         Filter__maybe_grow( fi );
+         lineno = FI_GET_LINENO(fi, atag);
+      }
+   }
+   if (fi->tags[lineno] == FI_INVALID_TAG) {
+      if (fi->n_dirty < FI_N_DIRTY)
+         fi->dirty[fi->n_dirty] = lineno;
+      if (fi->n_dirty <= FI_N_DIRTY)
+         fi->n_dirty++;
+   }
+
+   fi->tags[lineno] = atag;
+   line = &fi->lines[lineno];
+   for (i = 0; i < FI_LINE_SZB / 8; i++)
+      line->u16s[i] = 0;
+   return line;
 }
 
 /* Clearing an arbitrary range in the filter.  Unfortunately
@@ -3565,7 +3709,7 @@ static void Filter__clear ( Filter* fi, const HChar* who )
 static void Filter__clear_1byte ( Filter* fi, Addr a )
 {
    Addr    atag   = FI_GET_TAG(a);     /* tag of 'a' */
-   UWord   lineno = FI_GET_LINENO(a);  /* lineno for 'a' */
+   UWord   lineno = FI_GET_LINENO(fi, a); /* lineno for 'a' */
    FiLine* line   = &fi->lines[lineno];
    UWord   loff   = (a - atag) / 8;
    UShort  mask   = 0x3 << (2 * (a & 7));
@@ -3582,7 +3726,7 @@ static void Filter__clear_1byte ( Filter* fi, Addr a )
 static void Filter__clear_8bytes_aligned ( Filter* fi, Addr a )
 {
    Addr    atag   = FI_GET_TAG(a);     /* tag of 'a' */
-   UWord   lineno = FI_GET_LINENO(a);  /* lineno for 'a' */
+   UWord   lineno = FI_GET_LINENO(fi, a); /* lineno for 'a' */
    FiLine* line   = &fi->lines[lineno];
    UWord   loff   = (a - atag) / 8;
    if (LIKELY( fi->tags[lineno] == atag )) {
@@ -3626,6 +3770,12 @@ static void Filter__clear_range ( Filter* fi, Addr a, UWord len )
       copy of the data, then do it the fast way. On RETURN, we check
       the two values are equal. */
    Filter fi_check = *fi;
+   fi_check.tags  = HG_(zalloc)( "libhb.Filter__clear_range.1",
+                                 FI_NUM_LINES(fi) * sizeof(Addr) );
+   fi_check.lines = HG_(zalloc)( "libhb.Filter__clear_range.2",
+                                 FI_NUM_LINES(fi) * sizeof(FiLine) );
+   VG_(memcpy)(fi_check.tags,  fi->tags,  FI_NUM_LINES(fi) * sizeof(Addr));
+   VG_(memcpy)(fi_check.lines, fi->lines, FI_NUM_LINES(fi) * sizeof(FiLine));
    Filter__clear_range_SLOW(&fi_check, a, len);
 #  define RETURN goto check_and_return
 #  else
@@ -3640,7 +3790,7 @@ static void Filter__clear_range ( Filter* fi, Addr a, UWord len )
    UWord rlen = len; /* remaining length to clear */
 
    Addr    c = a; /* Current position we are clearing. */
-   UWord   clineno = FI_GET_LINENO(c); /* Current lineno we are clearing */
+   UWord   clineno = FI_GET_LINENO(fi, c); /* Current lineno we are clearing */
    FiLine* cline; /* Current line we are clearing */
    UWord   cloff; /* Current offset in line we are clearing, when clearing
                      partial lines. */
@@ -3696,7 +3846,7 @@ static void Filter__clear_range ( Filter* fi, Addr a, UWord len )
       rlen -= c - a;
    }
    // We have changed c, so re-establish clineno.
-   clineno = FI_GET_LINENO(c);
+   clineno = FI_GET_LINENO(fi, c);
 
    if (rlen >= FI_LINE_SZB) {
       /* Here, c is filter line-aligned. Clear all full lines that
@@ -3704,8 +3854,8 @@ static void Filter__clear_range ( Filter* fi, Addr a, UWord len )
       UWord nfull = rlen / FI_LINE_SZB;
       UWord full_len = nfull * FI_LINE_SZB;
       rlen -= full_len;
-      if (nfull > FI_NUM_LINES)
-         nfull = FI_NUM_LINES; // no need to check several times the same entry.
+      if (nfull > FI_NUM_LINES(fi))
+         nfull = FI_NUM_LINES(fi); // no need to check several times the same entry.
 
       for (UWord n = 0; n < nfull; n++) {
          if (UNLIKELY(address_in_range(fi->tags[clineno], c, full_len))) {
@@ -3717,17 +3867,17 @@ static void Filter__clear_range ( Filter* fi, Addr a, UWord len )
             STATIC_ASSERT (4 == sizeof(cline->u16s)/sizeof(cline->u16s[0]));
          }
          clineno++;
-         if (UNLIKELY(clineno == FI_NUM_LINES))
+         if (UNLIKELY(clineno == FI_NUM_LINES(fi)))
             clineno = 0;
       }
 
       c += full_len;
-      clineno = FI_GET_LINENO(c);
+      clineno = FI_GET_LINENO(fi, c);
    }
 
    if (CHECK_ZSM) {
       tl_assert(VG_IS_8_ALIGNED(c));
-      tl_assert(clineno == FI_GET_LINENO(c));
+      tl_assert(clineno == FI_GET_LINENO(fi, c));
    }
 
    /* Do the last filter line, if it was not cleared as a full filter line */
@@ -3759,7 +3909,12 @@ static void Filter__clear_range ( Filter* fi, Addr a, UWord len )
 
 #  if CHECK_ZSM > 0
    check_and_return:
-   tl_assert (VG_(memcmp)(&fi_check, fi, sizeof(fi_check)) == 0);
+   tl_assert (VG_(memcmp)(fi_check.tags, fi->tags,
+                          FI_NUM_LINES(fi) * sizeof(Addr)) == 0);
+   tl_assert (VG_(memcmp)(fi_check.lines, fi->lines,
+                          FI_NUM_LINES(fi) * sizeof(FiLine)) == 0);
+   HG_(free)(fi_check.tags);
+   HG_(free)(fi_check.lines);
 #  endif
 #  undef RETURN
 }
@@ -3772,7 +3927,7 @@ static inline Bool Filter__ok_to_skip_crd64 ( Filter* fi, Addr a )
       return False;
    { 
      Addr    atag   = FI_GET_TAG(a);     /* tag of 'a' */
-     UWord   lineno = FI_GET_LINENO(a);  /* lineno for 'a' */
+     UWord   lineno = FI_GET_LINENO(fi, a); /* lineno for 'a' */
      FiLine* line   = &fi->lines[lineno];
      UWord   loff   = (a - atag) / 8;
      UShort  mask   = 0xAAAA;
@@ -3784,10 +3939,7 @@ static inline Bool Filter__ok_to_skip_crd64 ( Filter* fi, Addr a )
         return ok;
      } else {
         /* miss.  nuke existing line and re-use it. */
-        UWord i;
-        fi->tags[lineno] = atag;
-        for (i = 0; i < FI_LINE_SZB / 8; i++)
-           line->u16s[i] = 0;
+        line = Filter__fill(fi, atag);
         line->u16s[loff] = mask;
         return False;
      }
@@ -3800,7 +3952,7 @@ static inline Bool Filter__ok_to_skip_crd32 ( Filter* fi, Addr a )
       return False;
    {
      Addr    atag   = FI_GET_TAG(a);     /* tag of 'a' */
-     UWord   lineno = FI_GET_LINENO(a);  /* lineno for 'a' */
+     UWord   lineno = FI_GET_LINENO(fi, a); /* lineno for 'a' */
      FiLine* line   = &fi->lines[lineno];
      UWord   loff   = (a - atag) / 8;
      UShort  mask   = 0xAA << (2 * (a & 4)); /* 0xAA00 or 0x00AA */
@@ -3812,10 +3964,7 @@ static inline Bool Filter__ok_to_skip_crd32 ( Filter* fi, Addr a )
         return ok;
      } else {
         /* miss.  nuke existing line and re-use it. */
-        UWord   i;
-        fi->tags[lineno] = atag;
-        for (i = 0; i < FI_LINE_SZB / 8; i++)
-           line->u16s[i] = 0;
+        line = Filter__fill(fi, atag);
         line->u16s[loff] = mask;
         return False;
      }
@@ -3828,7 +3977,7 @@ static inline Bool Filter__ok_to_skip_crd16 ( Filter* fi, Addr a )
       return False;
    {
      Addr    atag   = FI_GET_TAG(a);     /* tag of 'a' */
-     UWord   lineno = FI_GET_LINENO(a);  /* lineno for 'a' */
+     UWord   lineno = FI_GET_LINENO(fi, a); /* lineno for 'a' */
      FiLine* line   = &fi->lines[lineno];
      UWord   loff   = (a - atag) / 8;
      UShort  mask   = 0xA << (2 * (a & 6));
@@ -3841,10 +3990,7 @@ static inline Bool Filter__ok_to_skip_crd16 ( Filter* fi, Addr a )
         return ok;
      } else {
         /* miss.  nuke existing line and re-use it. */
-        UWord   i;
-        fi->tags[lineno] = atag;
-        for (i = 0; i < FI_LINE_SZB / 8; i++)
-           line->u16s[i] = 0;
+        line = Filter__fill(fi, atag);
         line->u16s[loff] = mask;
         return False;
      }
@@ -3855,7 +4001,7 @@ static inline Bool Filter__ok_to_skip_crd08 ( Filter* fi, Addr a )
 {
    {
      Addr    atag   = FI_GET_TAG(a);     /* tag of 'a' */
-     UWord   lineno = FI_GET_LINENO(a);  /* lineno for 'a' */
+     UWord   lineno = FI_GET_LINENO(fi, a); /* lineno for 'a' */
      FiLine* line   = &fi->lines[lineno];
      UWord   loff   = (a - atag) / 8;
      UShort  mask   = 0x2 << (2 * (a & 7));
@@ -3868,10 +4014,7 @@ static inline Bool Filter__ok_to_skip_crd08 ( Filter* fi, Addr a )
         return ok;
      } else {
         /* miss.  nuke existing line and re-use it. */
-        UWord   i;
-        fi->tags[lineno] = atag;
-        for (i = 0; i < FI_LINE_SZB / 8; i++)
-           line->u16s[i] = 0;
+        line = Filter__fill(fi, atag);
         line->u16s[loff] = mask;
         return False;
      }
@@ -3887,7 +4030,7 @@ static inline Bool Filter__ok_to_skip_cwr64 ( Filter* fi, Addr a )
       return False;
    { 
      Addr    atag   = FI_GET_TAG(a);     /* tag of 'a' */
-     UWord   lineno = FI_GET_LINENO(a);  /* lineno for 'a' */
+     UWord   lineno = FI_GET_LINENO(fi, a); /* lineno for 'a' */
      FiLine* line   = &fi->lines[lineno];
      UWord   loff   = (a - atag) / 8;
      UShort  mask   = 0xFFFF;
@@ -3899,10 +4042,7 @@ static inline Bool Filter__ok_to_skip_cwr64 ( Filter* fi, Addr a )
         return ok;
      } else {
         /* miss.  nuke existing line and re-use it. */
-        UWord i;
-        fi->tags[lineno] = atag;
-        for (i = 0; i < FI_LINE_SZB / 8; i++)
-           line->u16s[i] = 0;
+        line = Filter__fill(fi, atag);
         line->u16s[loff] = mask;
         return False;
      }
@@ -3915,7 +4055,7 @@ static inline Bool Filter__ok_to_skip_cwr32 ( Filter* fi, Addr a )
       return False;
    {
      Addr    atag   = FI_GET_TAG(a);     /* tag of 'a' */
-     UWord   lineno = FI_GET_LINENO(a);  /* lineno for 'a' */
+     UWord   lineno = FI_GET_LINENO(fi, a); /* lineno for 'a' */
      FiLine* line   = &fi->lines[lineno];
      UWord   loff   = (a - atag) / 8;
      UShort  mask   = 0xFF << (2 * (a & 4)); /* 0xFF00 or 0x00FF */
@@ -3927,10 +4067,7 @@ static inline Bool Filter__ok_to_skip_cwr32 ( Filter* fi, Addr a )
         return ok;
      } else {
         /* miss.  nuke existing line and re-use it. */
-        UWord   i;
-        fi->tags[lineno] = atag;
-        for (i = 0; i < FI_LINE_SZB / 8; i++)
-           line->u16s[i] = 0;
+        line = Filter__fill(fi, atag);
         line->u16s[loff] = mask;
         return False;
      }
@@ -3943,7 +4080,7 @@ static inline Bool Filter__ok_to_skip_cwr16 ( Filter* fi, Addr a )
       return False;
    {
      Addr    atag   = FI_GET_TAG(a);     /* tag of 'a' */
-     UWord   lineno = FI_GET_LINENO(a);  /* lineno for 'a' */
+     UWord   lineno = FI_GET_LINENO(fi, a); /* lineno for 'a' */
      FiLine* line   = &fi->lines[lineno];
      UWord   loff   = (a - atag) / 8;
      UShort  mask   = 0xF << (2 * (a & 6));
@@ -3956,10 +4093,7 @@ static inline Bool Filter__ok_to_skip_cwr16 ( Filter* fi, Addr a )
         return ok;
      } else {
         /* miss.  nuke existing line and re-use it. */
-        UWord   i;
-        fi->tags[lineno] = atag;
-        for (i = 0; i < FI_LINE_SZB / 8; i++)
-           line->u16s[i] = 0;
+        line = Filter__fill(fi, atag);
         line->u16s[loff] = mask;
         return False;
      }
@@ -3970,7 +4104,7 @@ static inline Bool Filter__ok_to_skip_cwr08 ( Filter* fi, Addr a )
 {
    {
      Addr    atag   = FI_GET_TAG(a);     /* tag of 'a' */
-     UWord   lineno = FI_GET_LINENO(a);  /* lineno for 'a' */
+     UWord   lineno = FI_GET_LINENO(fi, a); /* lineno for 'a' */
      FiLine* line   = &fi->lines[lineno];
      UWord   loff   = (a - atag) / 8;
      UShort  mask   = 0x3 << (2 * (a & 7));
@@ -3983,10 +4117,7 @@ static inline Bool Filter__ok_to_skip_cwr08 ( Filter* fi, Addr a )
         return ok;
      } else {
         /* miss.  nuke existing line and re-use it. */
-        UWord   i;
-        fi->tags[lineno] = atag;
-        for (i = 0; i < FI_LINE_SZB / 8; i++)
-           line->u16s[i] = 0;
+        line = Filter__fill(fi, atag);
         line->u16s[loff] = mask;
         return False;
      }
@@ -4025,7 +4156,7 @@ static Thr* Thr__new ( void )
    thr->viW = VtsID_INVALID;
    thr->llexit_done = False;
    thr->joinedwith_done = False;
-   thr->filter = HG_(zalloc)( "libhb.Thr__new.2", sizeof(Filter) );
+   thr->filter = Filter__new();
    if (HG_(clo_history_level) == 1)
       thr->local_Kws_n_stacks
          = VG_(newXA)( HG_(zalloc),
@@ -5874,9 +6005,6 @@ static void zsm_sset_range ( Addr a, SizeT len, SVal svNew )
 //                                                     //
 /////////////////////////////////////////////////////////
 
-static UWord stats__f_ac = 0;
-static UWord stats__f_sk = 0;
-
 #if 0
 #  define STATS__F_SHOW \
      do { \
@@ -6392,15 +6520,24 @@ void libhb_shutdown ( Bool show_stats )
                   (Word)N_LINE_ARANGE);
 
       VG_(printf)("%s","\n");
+      VG_(printf)("  filter: %'13lu accesses (%'lu skipped),"
+                  " %'lu conflict misses\n",
+                  stats__f_ac, stats__f_sk, stats__filter_evictions);
+      VG_(printf)("  filter: %'13lu clears (%'lu partial), %'lu grows\n",
+                  stats__filter_clears, stats__filter_clears_partial,
+                  stats__filter_grows);
 
+      VG_(printf)("%s","\n");
       VG_(printf)("   libhb: %'13llu msmcread  (%'llu dragovers)\n",
                   stats__msmcread, stats__msmcread_change);
       VG_(printf)("   libhb: %'13llu msmcwrite (%'llu dragovers)\n",
                   stats__msmcwrite, stats__msmcwrite_change);
       VG_(printf)("   libhb: %'13llu cmpLEQ queries (%'llu misses)\n",
                   stats__cmpLEQ_queries, stats__cmpLEQ_misses);
-      VG_(printf)("   libhb: %'13llu join2  queries (%'llu misses)\n",
-                  stats__join2_queries, stats__join2_misses);
+      VG_(printf)("   libhb: %'13llu join2  queries (%'llu misses,"
+                  " %'llu dominated)\n",
+                  stats__join2_queries, stats__join2_misses,
+                  stats__join2_dominated);
 
       VG_(printf)("%s","\n");
       VG_(printf)("   libhb: VTSops: tick %'lu,  join %'lu,  cmpLEQ %'lu\n",
@@ -6420,8 +6557,8 @@ void libhb_shutdown ( Bool show_stats )
       );
       VG_(printf)("   libhb: #%lu vts_tab GC    #%lu vts pruning\n",
                   stats__vts_tab_GC, stats__vts_pruning);
-      VG_(printf)( "   libhb: %lu entries in vts_set\n",
-                   VG_(sizeFM)( vts_set ) );
+      VG_(printf)( "   libhb: %u entries in vts_set\n",
+                   VG_(HT_count_nodes)( vts_set ) );
 
       VG_(printf)("%s","\n");
       {
@@ -6555,7 +6692,7 @@ void libhb_async_exit ( Thr* thr )
    /* free up Filter and local_Kws_n_stacks (well, actually not the
       latter ..) */
    tl_assert(thr->filter);
-   HG_(free)(thr->filter);
+   Filter__delete(thr->filter);
    thr->filter = NULL;
 
    /* Tell the VTS mechanism this thread has exited, so it can
@@ -6698,8 +6835,16 @@ void libhb_so_recv ( Thr* thr, SO* so, Bool strong_recv )
          //VtsID__rcinc(thr->viW);
       }
 
-      if (thr->filter)
-         Filter__clear(thr->filter, "libhb_so_recv");
+      /* There is no need to clear the filter.  It records that this
+         thread has already done an access in its current segment,
+         and a receive does not start a new segment: only the other
+         threads' entries in the clocks have moved on, and our own
+         entry is what decides whether a later access by another
+         thread is ordered after the filtered ones.  So doing them
+         again would not make msmcread/msmcwrite report anything
+         different.  Lock-heavy code acquires locks far more often
+         than it makes other threads' accesses visible, so this keeps
+         most of the filtering. */
       note_local_Kw_n_stack_for(thr);
 
       if (strong_recv) 